@@ -4,6 +4,7 @@
 
 #include "http/HttpMsg.h"
 #include "http/HttpProtocol.h"
+#include "http/HttpParser.h"
 #include "http/HttpMsgHandler.h"
 #include "http/HttpMsgHandlerFactory.h"
 #include "http/HttpClient.h"
\ No newline at end of file
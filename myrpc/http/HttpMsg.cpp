@@ -7,6 +7,7 @@
 #include "../rpc/myrpc.pb.h"
 
 #include <cstring>
+#include <assert.h>
 
 namespace myrpc {
 
@@ -50,6 +51,12 @@ void HttpMessage::AddHeader(const char *name, int value) {
     AddHeader(name, tmp);
 }
 
+void HttpMessage::AddHeader(const char *name, const size_t name_length, const char *value, 
+    const size_t value_length) {
+    header_name_list_.emplace_back(name, name_length);
+    header_value_list_.emplace_back(value, value_length);
+}
+
 bool HttpMessage::RemoveHeader(const char *name) {
     bool ret{false};
 
@@ -100,6 +107,23 @@ void HttpMessage::AppendContent(const void *content, const int length, const int
     content_.append((char *) content, valid_length);
 }
 
+void HttpMessage::AddTrailer(const char *name, const char *value) {
+    trailer_name_list_.push_back(name);
+    trailer_value_list_.push_back(value);
+}
+
+size_t HttpMessage::GetTrailerCount() const {
+    return trailer_name_list_.size();
+}
+
+const char *HttpMessage::GetTrailerName(size_t index) const {
+    return index < trailer_name_list_.size() ? trailer_name_list_[index].c_str() : nullptr;
+}
+
+const char *HttpMessage::GetTrailerValue(size_t index) const {
+    return index < trailer_value_list_.size() ? trailer_value_list_[index].c_str() : nullptr;
+}
+
 const std::string &HttpMessage::content() const {
     return content_;
 }
@@ -144,8 +168,13 @@ int HttpRequest::Send(BaseTcpStream &socket) const {
     return ret;
 }
 
+//应答的版本和请求相同，HTTP/1.1的请求才能使用chunked的应答
 BaseResponse *HttpRequest::GenResponse() const {
-    return new HttpResponse;
+    HttpResponse *resp = new HttpResponse;
+    if (version()[0] != '\0')
+        resp->set_version(version());
+
+    return resp;
 }
 
 bool HttpRequest::keep_alive() const {
@@ -235,18 +264,25 @@ HttpResponse::~HttpResponse() {
 
 }
 
+/* 固定长度的实体总是按照实际长度发送Content-Length，已经设置的Content-Length和Transfer-Encoding被忽略.
+ * HTTP/1.1的链接默认是keep alive的，客户端需要Content-Length才能找到应答的结束.
+ * 1xx，204和304的应答没有实体，不发送Content-Length */
 int HttpResponse::Send(BaseTcpStream &socket) const {
+    if (body_reader_)
+        return SendStream(socket);
+
     socket << version() << " " << status_code() << " " << reason_phrase() << "\r\n";
 
     for (size_t i = 0; i < GetHeaderCount(); ++i) {
+        if (strcasecmp(GetHeaderName(i), HttpMessage::HEADER_CONTENT_LENGTH) == 0 ||
+            strcasecmp(GetHeaderName(i), HttpMessage::HEADER_TRANSFER_ENCODING) == 0)
+            continue;
         socket << GetHeaderName(i) << ": " << GetHeaderValue(i) << "\r\n";
     }
+    SendFixedHeaders(socket);
 
-    if (content().size() > 0) {
-        if (GetHeaderValue(HttpMessage::HEADER_CONTENT_LENGTH)) {
-            socket << HttpMessage::HEADER_CONTENT_LENGTH << ": " << content().size() << "\r\n";
-        }
-    }
+    if (status_code() / 100 != 1 && status_code() != 204 && status_code() != HttpProtocol::SC_NOT_MODIFIED)
+        socket << HttpMessage::HEADER_CONTENT_LENGTH << ": " << content().size() << "\r\n";
 
     socket << "\r\n";
 
@@ -261,6 +297,92 @@ int HttpResponse::Send(BaseTcpStream &socket) const {
     }
 }
 
+/* 每次从body_reader_读取一段数据马上发送，只需要一个chunk大小的缓存区，数据在全部产生之前就开始发送.
+ * HTTP/1.1时每段数据作为一个chunk发送，body_reader_出错时不发送最后的chunk，调用者会关闭链接，
+ * 客户端可以发现应答不完整. HTTP/1.0不支持chunked，不发送Content-Length，直接发送数据，
+ * 发送之后关闭链接作为实体的结束，见keep_alive */
+int HttpResponse::SendStream(BaseTcpStream &socket) const {
+    bool chunked = (strcmp(version(), "HTTP/1.1") == 0);
+    char *buff = (char *) malloc (MAX_CHUNK_LEN);
+    assert(buff != nullptr);
+
+    int ret = 0;
+    //每段数据都要马上发送，取消调用者为了合并应答设置的cork
+    socket.GetStreamBuf()->SetCork(false);
+
+    socket << version() << " " << status_code() << " " << reason_phrase() << "\r\n";
+
+    for (size_t i = 0; i < GetHeaderCount(); ++i) {
+        if (strcasecmp(GetHeaderName(i), HttpMessage::HEADER_CONTENT_LENGTH) == 0 ||
+            strcasecmp(GetHeaderName(i), HttpMessage::HEADER_TRANSFER_ENCODING) == 0 ||
+            (!chunked && strcasecmp(GetHeaderName(i), HttpMessage::HEADER_CONNECTION) == 0))
+            continue;
+        socket << GetHeaderName(i) << ": " << GetHeaderValue(i) << "\r\n";
+    }
+
+    if (chunked) {
+        SendFixedHeaders(socket);
+        //头部和第一个chunk一起发送
+        socket << HttpMessage::HEADER_TRANSFER_ENCODING << ": chunked\r\n\r\n";
+    }
+    else {
+        //固定头部中不能有Connection: Keep-Alive
+        if (fixed_headers_ != HttpProtocol::FixedHeaders::NONE) {
+            size_t length = 0;
+            const char *fixed = HttpProtocol::GetFixedHeaders(HttpProtocol::FixedHeaders::DATE_SERVER, &length);
+            socket.write(fixed, length);
+        }
+        socket << HttpMessage::HEADER_CONNECTION << ": close\r\n\r\n";
+    }
+
+    while (true) {
+        ssize_t len = body_reader_(buff, MAX_CHUNK_LEN);
+        if (len < 0) {
+            ret = -1;
+            break;
+        }
+
+        if (!chunked) {
+            if (len == 0)
+                break;
+
+            socket.write(buff, len);
+            if (!socket.flush().good())
+                break;
+            continue;
+        }
+
+        char size_line[32];
+        int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", (size_t) len);
+        socket.write(size_line, size_len);
+        if (len == 0) {
+            socket << "\r\n";
+            break;
+        }
+
+        socket.write(buff, len);
+        socket << "\r\n";
+        if (!socket.flush().good())
+            break;
+    }
+
+    free(buff);
+
+    if (socket.flush().good()) 
+        return ret;
+    else 
+        return static_cast<int>(socket.LastError());
+}
+
+void HttpResponse::SendFixedHeaders(BaseTcpStream &socket) const {
+    if (fixed_headers_ == HttpProtocol::FixedHeaders::NONE)
+        return;
+
+    size_t length = 0;
+    const char *fixed = HttpProtocol::GetFixedHeaders(fixed_headers_, &length);
+    socket.write(fixed, length);
+}
+
 void HttpResponse::SetFake(FakeReason reason) {
     switch (reason) {
         case FakeReason::DISPATCH_ERROR:
@@ -278,6 +400,26 @@ int HttpResponse::Modify(const bool keep_alive, const std::string &version) {
     return 0;
 }
 
+bool HttpResponse::keep_alive() const {
+    return !body_reader_ || strcmp(version(), "HTTP/1.1") == 0;
+}
+
+void HttpResponse::set_body_reader(const HttpBodyReader_t &body_reader) {
+    body_reader_ = body_reader;
+}
+
+const HttpBodyReader_t &HttpResponse::body_reader() const {
+    return body_reader_;
+}
+
+void HttpResponse::set_fixed_headers(const HttpProtocol::FixedHeaders fixed_headers) {
+    fixed_headers_ = fixed_headers;
+}
+
+HttpProtocol::FixedHeaders HttpResponse::fixed_headers() const {
+    return fixed_headers_;
+}
+
 int HttpResponse::result() {
     const char *result = GetHeaderValue(HttpMessage::HEADER_X_MYRPC_RESULT);
     return atoi(result == nullptr ? "-1" : result);
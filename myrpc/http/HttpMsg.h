@@ -5,11 +5,17 @@
 #pragma once
 
 #include "../msg.h"
+#include "HttpProtocol.h"
+#include <functional>
 #include <vector>
 #include <string>
+#include <sys/types.h>
 
 namespace myrpc {
 
+//流式应答的数据来源，每次把下一段数据写入buf，返回写入的长度，返回0表示数据结束，小于0表示出错
+typedef std::function<ssize_t(char *buf, const size_t size)> HttpBodyReader_t;
+
 //Http的基本消息格式
 class HttpMessage : virtual public BaseMessage {
 public:
@@ -39,6 +45,7 @@ public:
 
     void AddHeader(const char *name, const char *value);
     void AddHeader(const char *name, int value);
+    void AddHeader(const char *name, const size_t name_length, const char *value, const size_t value_length);
     bool RemoveHeader(const char *name);
     size_t GetHeaderCount() const;
     const char *GetHeaderName(size_t index) const;
@@ -46,6 +53,12 @@ public:
     const char *GetHeaderValue(const char *name) const;
     void AppendContent(const void *content, const int length = 0, const int max_length = 0);
 
+    //chunked实体最后的trailer头部，和头部分开保存
+    void AddTrailer(const char *name, const char *value);
+    size_t GetTrailerCount() const;
+    const char *GetTrailerName(size_t index) const;
+    const char *GetTrailerValue(size_t index) const;
+
     const std::string &content() const;
     void set_content(const char *const content, const int length = 0);
     std::string *mutable_content();
@@ -65,6 +78,7 @@ protected:
     std::vector<std::string> header_name_list_, header_value_list_;
 
 private:
+    std::vector<std::string> trailer_name_list_, trailer_value_list_;
     std::string content_;
     char version_[16];
     Direction direction_{Direction::NONE};
@@ -102,6 +116,11 @@ private:
 //Http的response
 class HttpResponse : public HttpMessage, public BaseResponse {
 public:
+    enum {
+        //流式应答每个chunk的最大长度
+        MAX_CHUNK_LEN = 8192
+    };
+
     HttpResponse();
     virtual ~HttpResponse() override;
 
@@ -114,13 +133,30 @@ public:
     virtual int result() override;
     virtual void set_result(const int result) override;
 
+    //HTTP/1.0的流式应答没有Content-Length，以关闭链接作为实体的结束
+    virtual bool keep_alive() const override;
+
     void set_status_code(int status_code);
     int status_code() const;
 
     void set_reason_phrase(const char *reason_phrase);
     const char *reason_phrase() const;
 
+    //设置之后Send不发送content，而是边读取边发送body_reader产生的数据.
+    //body_reader在IO线程发送应答时才被调用，只能使用协程的IO或者很快返回
+    void set_body_reader(const HttpBodyReader_t &body_reader);
+    const HttpBodyReader_t &body_reader() const;
+
+    //由HttpProtocol::FixRespHeaders设置，这些头部不在头部的列表中
+    void set_fixed_headers(const HttpProtocol::FixedHeaders fixed_headers);
+    HttpProtocol::FixedHeaders fixed_headers() const;
+
 private:
+    int SendStream(BaseTcpStream &socket) const;
+    void SendFixedHeaders(BaseTcpStream &socket) const;
+
+    HttpBodyReader_t body_reader_;
+    HttpProtocol::FixedHeaders fixed_headers_{HttpProtocol::FixedHeaders::NONE};
     int status_code_;
     char reason_phrase_[128];
 };
@@ -2,8 +2,11 @@
 
 #include "HttpMsgHandler.h"
 #include "HttpMsg.h"
+#include "HttpParser.h"
 #include "HttpProtocol.h"
 #include "../network/SocketStreamBase.h"
+#include <algorithm>
+#include <cstring>
 
 namespace myrpc {
 
@@ -55,4 +58,120 @@ bool HttpMessageHandler::keep_alive() const {
     return keep_alive_;
 }
 
+/* 解析器会原地改写缓存区，所以先找到头部结束的空行，只把头部拷贝出来解析.
+ * chunked的实体不解码，直接返回false */
+bool HttpMessageHandler::RequestBuffered(BaseTcpStream &socket) {
+    BaseTcpStreamBuf *buf = socket.GetStreamBuf();
+    const char *data = buf->RecvData();
+    const size_t size = buf->RecvDataSize();
+
+    //空行为"\n\n"或者"\n\r\n"
+    size_t header_length = 0;
+    const char *pos = data;
+    while ((pos = (const char *) memchr(pos, '\n', data + size - pos)) != nullptr) {
+        pos++;
+        if (pos < data + size && *pos == '\n') {
+            header_length = pos + 1 - data;
+            break;
+        }
+        if (pos + 1 < data + size && pos[0] == '\r' && pos[1] == '\n') {
+            header_length = pos + 2 - data;
+            break;
+        }
+    }
+    if (header_length == 0)
+        return false;
+
+    std::string header(data, header_length);
+    HttpRequestParser parser;
+    if (parser.Parse(&header[0], header.size()) != HttpRequestParser::Status::DONE)
+        return false;
+    if (parser.has_transfer_encoding())
+        return false;
+
+    return parser.content_length() <= 0 || (uint64_t) parser.content_length() <= size - header_length;
+}
+
+HttpParserMessageHandler::HttpParserMessageHandler(const size_t max_body_len)
+    : max_body_len_(max_body_len) {
+
+}
+
+/* 请求行和头部在接收缓存区中解析，解析完成后每个字段只拷贝一次到HttpRequest中.
+ * Content-Length来自客户端，不按照它预先分配内存，超过max_body_len_时直接返回错误.
+ * 实体先取走缓存区中已有的部分，剩下的直接接收到content中，content每次最多扩大BODY_RECV_STEP.
+ * Transfer-Encoding的实体交给HttpProtocol::RecvBody，chunked的实体同样在接收缓存区上增量解码 */
+int HttpParserMessageHandler::RecvRequest(BaseTcpStream &socket, BaseRequest *&req) {
+    BaseTcpStreamBuf *buf = socket.GetStreamBuf();
+    HttpRequestParser parser;
+
+    HttpRequestParser::Status status;
+    while ((status = parser.Parse(buf->RecvData(), buf->RecvDataSize())) == HttpRequestParser::Status::NEED_MORE) {
+        if (buf->RecvMore(MAX_HEADER_LEN) <= 0)
+            return static_cast<int> (socket.LastError());
+    }
+
+    if (status != HttpRequestParser::Status::DONE) {
+        //log
+        return -1;
+    }
+
+    if (parser.content_length() > 0 && (uint64_t) parser.content_length() > max_body_len_) {
+        //log
+        return -1;
+    }
+
+    HttpRequest *http_req = new HttpRequest;
+
+    char *data = buf->RecvData();
+    http_req->set_method(data + parser.method().offset);
+    http_req->set_uri(data + parser.uri().offset);
+    if (parser.version().length > 0)
+        http_req->set_version(data + parser.version().offset);
+    for (size_t i = 0; i < parser.GetHeaderCount(); i++) {
+        const HttpRequestParser::Range &name = parser.GetHeaderName(i);
+        const HttpRequestParser::Range &value = parser.GetHeaderValue(i);
+        http_req->AddHeader(data + name.offset, name.length, data + value.offset, value.length);
+    }
+
+    buf->ConsumeRecvData(parser.header_length());
+
+    int ret = 0;
+    if (parser.has_transfer_encoding()) {
+        ret = HttpProtocol::RecvBody(socket, http_req, max_body_len_);
+    }
+    else if (parser.content_length() > 0) {
+        size_t length = (size_t) parser.content_length();
+        std::string *content = http_req->mutable_content();
+
+        size_t received = std::min(length, buf->RecvDataSize());
+        content->assign(buf->RecvData(), received);
+        buf->ConsumeRecvData(received);
+
+        while (received < length) {
+            size_t step = std::min(length - received, (size_t) BODY_RECV_STEP);
+            content->resize(received + step);
+            ssize_t len = buf->RecvDirect(&(*content)[received], step);
+            if (len <= 0) {
+                ret = static_cast<int> (socket.LastError());
+                break;
+            }
+            received += len;
+            content->resize(received);
+        }
+    }
+
+    if (ret == 0) {
+        req_ = req = http_req;
+        version_ = (http_req->version() != nullptr ? http_req->version() : "");
+        keep_alive_ = http_req->keep_alive();
+    }
+    else {
+        delete http_req;
+        http_req = nullptr;
+    }
+
+    return ret;
+}
+
 }
\ No newline at end of file
@@ -25,9 +25,34 @@ public:
 
     virtual bool keep_alive() const override;
 
-private:
+    //请求行和头部已经完整，并且没有实体或者Content-Length的实体也已经在接收缓存区中
+    virtual bool RequestBuffered(BaseTcpStream &socket) override;
+
+protected:
     std::string version_;
     bool keep_alive_ = false;
 };
 
+//使用HttpRequestParser直接在接收缓存区上解析请求，其他部分和HttpMessageHandler相同
+class HttpParserMessageHandler : public HttpMessageHandler {
+public:
+    enum {
+        //请求行和头部的最大长度，接收缓存区最多扩大到这个大小
+        MAX_HEADER_LEN = 64 * 1024,
+        //实体的默认最大长度
+        DEFAULT_MAX_BODY_LEN = 16 * 1024 * 1024,
+        //Content-Length的实体每次最多扩大这么多，内存随着收到的数据增长
+        BODY_RECV_STEP = 64 * 1024
+    };
+
+    //实体超过max_body_len的请求返回错误，链接会被关闭
+    HttpParserMessageHandler(const size_t max_body_len = DEFAULT_MAX_BODY_LEN);
+    virtual ~HttpParserMessageHandler() override = default;
+
+    virtual int RecvRequest(BaseTcpStream &socket, BaseRequest *&req) override;
+
+private:
+    size_t max_body_len_;
+};
+
 }
\ No newline at end of file
@@ -10,4 +10,13 @@ std::unique_ptr<BaseMessageHandler> HttpMessageHandlerFactory::Create() {
     return std::move(std::unique_ptr<BaseMessageHandler> (new HttpMessageHandler));
 }
 
+HttpParserMessageHandlerFactory::HttpParserMessageHandlerFactory(const size_t max_body_len)
+    : max_body_len_(max_body_len) {
+
+}
+
+std::unique_ptr<BaseMessageHandler> HttpParserMessageHandlerFactory::Create() {
+    return std::move(std::unique_ptr<BaseMessageHandler> (new HttpParserMessageHandler(max_body_len_)));
+}
+
 }
\ No newline at end of file
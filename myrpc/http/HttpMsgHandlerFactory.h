@@ -3,6 +3,7 @@
 #pragma once 
 
 #include "../msg.h"
+#include "HttpMsgHandler.h"
 
 namespace myrpc {
 
@@ -14,4 +15,17 @@ public:
     virtual std::unique_ptr<BaseMessageHandler> Create() override;
 };
 
+//创建HttpParserMessageHandler，直接在接收缓存区上解析请求
+class HttpParserMessageHandlerFactory : virtual public BaseMessageHandlerFactory {
+public:
+    //max_body_len为请求实体的最大长度，传给创建的HttpParserMessageHandler
+    HttpParserMessageHandlerFactory(const size_t max_body_len = HttpParserMessageHandler::DEFAULT_MAX_BODY_LEN);
+    virtual ~HttpParserMessageHandlerFactory() override = default;
+
+    virtual std::unique_ptr<BaseMessageHandler> Create() override;
+
+private:
+    size_t max_body_len_;
+};
+
 }
@@ -0,0 +1,371 @@
+/* 可以中断后继续的http请求解析器，直接在链接的接收缓存区上解析请求行和头部.
+ * 不经过istream，也不拷贝每一行，只记录各个字段相对于请求开始位置的偏移和长度.
+ * 数据不完整时返回NEED_MORE，收到更多数据后用同一个请求的全部数据再次调用，从上次停止的行继续.
+ * 解析完成的行中，字段后面的分隔符会被原地改写为'\0'，字段可以直接当作C字符串使用.
+ * 不支持头部的多行折叠(obs-fold)，遇到时返回ERROR.
+ * HttpChunkedDecoder同样在接收缓存区上增量解码chunked的实体，解码出的数据直接追加到实体中.
+ * */
+
+#include "HttpParser.h"
+#include <cstring>
+#include <strings.h>
+
+namespace {
+
+bool IsSpace(const char c) {
+    return c == ' ' || c == '\t';
+}
+
+int HexValue(const char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+}
+
+namespace myrpc {
+
+HttpRequestParser::HttpRequestParser() {
+    Reset();
+}
+
+HttpRequestParser::~HttpRequestParser() {
+
+}
+
+void HttpRequestParser::Reset() {
+    state_ = State::START_LINE;
+    line_begin_ = 0;
+    scan_pos_ = 0;
+    method_ = uri_ = version_ = Range();
+    header_name_list_.clear();
+    header_value_list_.clear();
+    header_length_ = 0;
+    content_length_ = -1;
+    has_transfer_encoding_ = false;
+}
+
+/* 每次取出一个完整的行处理，没有换行符时记住找过的位置，等待更多数据.
+ * 换行符、空格和冒号都用memchr查找，glibc在运行时按照CPUID选择SSE2、AVX2或EVEX的实现，
+ * 一次比较16到64个字节. 头部的行通常短于64字节，memchr在第一组中就能找到，
+ * 按64字节生成换行符和冒号掩码的AVX2/SSE2实现因为每行多出的分支反而更慢 */
+HttpRequestParser::Status HttpRequestParser::Parse(char *data, const size_t size) {
+    while (state_ != State::DONE) {
+        if (scan_pos_ >= size)
+            return Status::NEED_MORE;
+
+        char *lf = (char *) memchr(data + scan_pos_, '\n', size - scan_pos_);
+        if (lf == nullptr) {
+            scan_pos_ = size;
+            return Status::NEED_MORE;
+        }
+
+        size_t line_end = lf - data;
+        size_t length = line_end - line_begin_;
+        if (length > 0 && data[line_end - 1] == '\r')
+            length--;
+
+        if (state_ == State::START_LINE) {
+            //请求行之前的空行忽略
+            if (length > 0) {
+                if (!ParseStartLine(data, line_begin_, length))
+                    return Status::ERROR;
+                state_ = State::HEADERS;
+            }
+        }
+        else if (length == 0) {
+            header_length_ = line_end + 1;
+            state_ = State::DONE;
+        }
+        else if (!ParseHeaderLine(data, line_begin_, length)) {
+            return Status::ERROR;
+        }
+
+        line_begin_ = scan_pos_ = line_end + 1;
+    }
+
+    return Status::DONE;
+}
+
+//请求行为"方法 URI 版本"，没有版本时按照HTTP/0.9处理，version为空
+bool HttpRequestParser::ParseStartLine(char *data, const size_t begin, const size_t length) {
+    char *line = data + begin;
+
+    char *method_end = (char *) memchr(line, ' ', length);
+    if (method_end == nullptr || method_end == line)
+        return false;
+
+    char *uri_begin = method_end + 1;
+    size_t rest = length - (uri_begin - line);
+    char *uri_end = (char *) memchr(uri_begin, ' ', rest);
+    if (uri_end == nullptr)
+        uri_end = line + length;
+    if (uri_end == uri_begin)
+        return false;
+
+    method_.offset = begin;
+    method_.length = method_end - line;
+    uri_.offset = uri_begin - data;
+    uri_.length = uri_end - uri_begin;
+    if (uri_end < line + length) {
+        version_.offset = uri_end + 1 - data;
+        version_.length = line + length - (uri_end + 1);
+    }
+    else {
+        version_.offset = begin + length;
+        version_.length = 0;
+    }
+
+    *method_end = '\0';
+    *uri_end = '\0';
+    line[length] = '\0';
+
+    return true;
+}
+
+//头部为"名字: 值"，名字和冒号之间不能有空白，值前后的空白去掉
+bool HttpRequestParser::ParseHeaderLine(char *data, const size_t begin, const size_t length) {
+    char *line = data + begin;
+
+    //多行折叠的头部
+    if (IsSpace(*line))
+        return false;
+
+    char *colon = (char *) memchr(line, ':', length);
+    if (colon == nullptr || colon == line || IsSpace(*(colon - 1)))
+        return false;
+
+    char *value_begin = colon + 1;
+    char *value_end = line + length;
+    while (value_begin < value_end && IsSpace(*value_begin))
+        value_begin++;
+    while (value_end > value_begin && IsSpace(*(value_end - 1)))
+        value_end--;
+
+    Range name, value;
+    name.offset = begin;
+    name.length = colon - line;
+    value.offset = value_begin - data;
+    value.length = value_end - value_begin;
+
+    *colon = '\0';
+    *value_end = '\0';
+
+    if (name.length == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+        if (value.length == 0 || value.length > 18)
+            return false;
+
+        int64_t content_length = 0;
+        for (char *p = value_begin; p < value_end; p++) {
+            if (*p < '0' || *p > '9')
+                return false;
+            content_length = content_length * 10 + (*p - '0');
+        }
+
+        //多个不同的Content-Length无法确定请求的边界
+        if (content_length_ >= 0 && content_length_ != content_length)
+            return false;
+        content_length_ = content_length;
+    }
+    else if (name.length == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+        has_transfer_encoding_ = true;
+    }
+
+    header_name_list_.push_back(name);
+    header_value_list_.push_back(value);
+
+    return true;
+}
+
+const HttpRequestParser::Range &HttpRequestParser::method() const {
+    return method_;
+}
+
+const HttpRequestParser::Range &HttpRequestParser::uri() const {
+    return uri_;
+}
+
+const HttpRequestParser::Range &HttpRequestParser::version() const {
+    return version_;
+}
+
+size_t HttpRequestParser::GetHeaderCount() const {
+    return header_name_list_.size();
+}
+
+const HttpRequestParser::Range &HttpRequestParser::GetHeaderName(const size_t index) const {
+    return header_name_list_[index];
+}
+
+const HttpRequestParser::Range &HttpRequestParser::GetHeaderValue(const size_t index) const {
+    return header_value_list_[index];
+}
+
+size_t HttpRequestParser::header_length() const {
+    return header_length_;
+}
+
+int64_t HttpRequestParser::content_length() const {
+    return content_length_;
+}
+
+bool HttpRequestParser::has_transfer_encoding() const {
+    return has_transfer_encoding_;
+}
+
+HttpChunkedDecoder::HttpChunkedDecoder() {
+    Reset();
+}
+
+HttpChunkedDecoder::~HttpChunkedDecoder() {
+
+}
+
+void HttpChunkedDecoder::Reset() {
+    state_ = State::SIZE_LINE;
+    chunk_left_ = 0;
+    trailer_name_list_.clear();
+    trailer_value_list_.clear();
+}
+
+/* 实体为若干个"长度[;扩展]CRLF 数据CRLF"，最后是长度为0的chunk，trailer头部和一个空行.
+ * 长度行和trailer行需要完整才处理，数据部分收到多少就解码多少 */
+HttpChunkedDecoder::Status HttpChunkedDecoder::Decode(const char *data, const size_t size, 
+    size_t &consumed, std::string *content) {
+    size_t pos = 0;
+    consumed = 0;
+
+    while (state_ != State::DONE) {
+        if (state_ == State::DATA) {
+            size_t length = size - pos;
+            if (length > chunk_left_)
+                length = (size_t) chunk_left_;
+            content->append(data + pos, length);
+            pos += length;
+            chunk_left_ -= length;
+
+            if (chunk_left_ > 0)
+                break;
+
+            state_ = State::DATA_END;
+            continue;
+        }
+
+        if (pos >= size)
+            break;
+
+        if (state_ == State::DATA_END) {
+            //数据后面的CRLF，也接受单独的LF
+            if (data[pos] == '\r') {
+                if (pos + 1 >= size)
+                    break;
+                if (data[pos + 1] != '\n')
+                    return Status::ERROR;
+                pos += 2;
+            }
+            else if (data[pos] == '\n') {
+                pos++;
+            }
+            else {
+                return Status::ERROR;
+            }
+
+            state_ = State::SIZE_LINE;
+            continue;
+        }
+
+        const char *lf = (const char *) memchr(data + pos, '\n', size - pos);
+        if (lf == nullptr)
+            break;
+
+        size_t length = lf - (data + pos);
+        if (length > 0 && data[pos + length - 1] == '\r')
+            length--;
+
+        if (state_ == State::SIZE_LINE) {
+            if (!ParseSizeLine(data + pos, length))
+                return Status::ERROR;
+            state_ = chunk_left_ > 0 ? State::DATA : State::TRAILER;
+        }
+        else if (length == 0) {
+            state_ = State::DONE;
+        }
+        else if (!ParseTrailerLine(data + pos, length)) {
+            return Status::ERROR;
+        }
+
+        pos = lf - data + 1;
+    }
+
+    consumed = pos;
+
+    return state_ == State::DONE ? Status::DONE : Status::NEED_MORE;
+}
+
+//长度为十六进制，后面可以有空白和以';'开始的扩展
+bool HttpChunkedDecoder::ParseSizeLine(const char *line, const size_t length) {
+    size_t i = 0;
+    uint64_t chunk_size = 0;
+
+    for ( ; i < length; i++) {
+        int value = HexValue(line[i]);
+        if (value < 0)
+            break;
+        //超过64位
+        if (chunk_size >> 60)
+            return false;
+        chunk_size = (chunk_size << 4) | value;
+    }
+
+    if (i == 0)
+        return false;
+
+    while (i < length && IsSpace(line[i]))
+        i++;
+    if (i < length && line[i] != ';')
+        return false;
+
+    chunk_left_ = chunk_size;
+
+    return true;
+}
+
+bool HttpChunkedDecoder::ParseTrailerLine(const char *line, const size_t length) {
+    if (IsSpace(*line))
+        return false;
+
+    const char *colon = (const char *) memchr(line, ':', length);
+    if (colon == nullptr || colon == line || IsSpace(*(colon - 1)))
+        return false;
+
+    const char *value_begin = colon + 1;
+    const char *value_end = line + length;
+    while (value_begin < value_end && IsSpace(*value_begin))
+        value_begin++;
+    while (value_end > value_begin && IsSpace(*(value_end - 1)))
+        value_end--;
+
+    trailer_name_list_.emplace_back(line, colon - line);
+    trailer_value_list_.emplace_back(value_begin, value_end - value_begin);
+
+    return true;
+}
+
+size_t HttpChunkedDecoder::GetTrailerCount() const {
+    return trailer_name_list_.size();
+}
+
+const std::string &HttpChunkedDecoder::GetTrailerName(const size_t index) const {
+    return trailer_name_list_[index];
+}
+
+const std::string &HttpChunkedDecoder::GetTrailerValue(const size_t index) const {
+    return trailer_value_list_[index];
+}
+
+}
@@ -0,0 +1,122 @@
+/* 可以中断后继续的http请求解析器，直接在链接的接收缓存区上解析请求行和头部.
+ * 不经过istream，也不拷贝每一行，只记录各个字段相对于请求开始位置的偏移和长度.
+ * 数据不完整时返回NEED_MORE，收到更多数据后用同一个请求的全部数据再次调用，从上次停止的行继续.
+ * 解析完成的行中，字段后面的分隔符会被原地改写为'\0'，字段可以直接当作C字符串使用.
+ * 不支持头部的多行折叠(obs-fold)，遇到时返回ERROR.
+ * HttpChunkedDecoder同样在接收缓存区上增量解码chunked的实体，解码出的数据直接追加到实体中.
+ * */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace myrpc {
+
+class HttpRequestParser {
+public:
+    enum class Status {
+        NEED_MORE = 0,
+        DONE,
+        ERROR,
+    };
+
+    //相对于请求开始位置的一个字段
+    struct Range {
+        size_t offset = 0;
+        size_t length = 0;
+    };
+
+    HttpRequestParser();
+    ~HttpRequestParser();
+
+    //开始解析一个新的请求
+    void Reset();
+
+    //data为请求开始的位置，size为目前收到的全部数据的长度.
+    //数据在两次调用之间可以被移动，但已经收到的部分不能改变
+    Status Parse(char *data, const size_t size);
+
+    const Range &method() const;
+    const Range &uri() const;
+    const Range &version() const;
+
+    size_t GetHeaderCount() const;
+    const Range &GetHeaderName(const size_t index) const;
+    const Range &GetHeaderValue(const size_t index) const;
+
+    //请求行和头部的总长度，包括最后的空行，DONE之后有效
+    size_t header_length() const;
+    //没有Content-Length头部时为-1
+    int64_t content_length() const;
+    bool has_transfer_encoding() const;
+
+private:
+    enum class State {
+        START_LINE = 0,
+        HEADERS,
+        DONE,
+    };
+
+    //begin为一行开始的位置，length不包括行尾的CRLF
+    bool ParseStartLine(char *data, const size_t begin, const size_t length);
+    bool ParseHeaderLine(char *data, const size_t begin, const size_t length);
+
+    State state_;
+    //下一行开始的位置
+    size_t line_begin_;
+    //在line_begin_之后已经找过换行符的位置，再次调用时从这里继续找
+    size_t scan_pos_;
+
+    Range method_, uri_, version_;
+    std::vector<Range> header_name_list_, header_value_list_;
+    size_t header_length_;
+    int64_t content_length_;
+    bool has_transfer_encoding_;
+};
+
+//chunked的实体解码器，忽略chunk扩展，保存最后的trailer头部
+class HttpChunkedDecoder {
+public:
+    enum class Status {
+        NEED_MORE = 0,
+        DONE,
+        ERROR,
+    };
+
+    HttpChunkedDecoder();
+    ~HttpChunkedDecoder();
+
+    //开始解码一个新的实体
+    void Reset();
+
+    //data为还没有处理的数据，解码出的数据追加到content中，consumed为处理完、可以丢弃的长度.
+    //返回NEED_MORE时剩下的是不完整的一行，收到更多数据后和这些数据一起再次调用
+    Status Decode(const char *data, const size_t size, size_t &consumed, std::string *content);
+
+    size_t GetTrailerCount() const;
+    const std::string &GetTrailerName(const size_t index) const;
+    const std::string &GetTrailerValue(const size_t index) const;
+
+private:
+    enum class State {
+        SIZE_LINE = 0,
+        DATA,
+        DATA_END,
+        TRAILER,
+        DONE,
+    };
+
+    //length不包括行尾的CRLF
+    bool ParseSizeLine(const char *line, const size_t length);
+    bool ParseTrailerLine(const char *line, const size_t length);
+
+    State state_;
+    //当前chunk还没有解码的长度
+    uint64_t chunk_left_;
+    std::vector<std::string> trailer_name_list_, trailer_value_list_;
+};
+
+}
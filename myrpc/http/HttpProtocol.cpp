@@ -5,6 +5,7 @@
 
 #include "HttpProtocol.h"
 #include "HttpMsg.h"
+#include "HttpParser.h"
 #include "../network/SocketStreamBase.h"
 #include <cstring>
 #include <assert.h>
@@ -63,36 +64,95 @@ void URLEncode(const char *source, char *dest, size_t length) {
     *q = 0;
 }
 
+//每个线程预先生成的Date、Server和Connection头部，Date每秒更新一次.
+//data中依次为Date，Server和Connection，不需要Connection时只取前面一部分
+struct FixedHeaderBlock {
+    time_t second;
+    //由调度器每秒刷新时，取用时不再检查时间
+    bool refreshed_by_scheduler;
+    size_t date_server_length;
+    size_t keep_alive_length;
+    char data[128];
+};
+
+__thread FixedHeaderBlock fixed_header_block;
+
+void BuildFixedHeaders(FixedHeaderBlock *block, const time_t now) {
+    const char keep_alive[] = "Connection: Keep-Alive\r\n";
+
+    struct tm tm_time;
+    gmtime_r(&now, &tm_time);
+    size_t length = strftime(block->data, sizeof(block->data) - sizeof(keep_alive), 
+            "Date: %a, %d %b %Y %H:%M:%S GMT\r\nServer: http/myrpc\r\n", &tm_time);
+    memcpy(block->data + length, keep_alive, sizeof(keep_alive) - 1);
+
+    block->date_server_length = length;
+    block->keep_alive_length = length + sizeof(keep_alive) - 1;
+    block->second = now;
+}
+
 }
 
 namespace myrpc {
 
+/* Date，Server和Connection不再加入头部的列表，Send时从当前线程预先生成的固定头部中一次写入.
+ * 应答中已有的Date和Server被去掉，已有Connection时不再添加 */
 void HttpProtocol::FixRespHeaders(bool keep_alive, const char *version, HttpResponse *resp) {
-    char buffer[256] = {0};
-
-    //检查keep-alive头部
-    if (keep_alive) {
-        if (resp->GetHeaderValue(HttpMessage::HEADER_CONNECTION) == nullptr) {
-            resp->AddHeader(HttpMessage::HEADER_CONNECTION, "Keep-Alive");
-        }
+    bool has_connection = false;
+    bool has_fixed = false;
+
+    for (size_t i = 0; i < resp->GetHeaderCount(); i++) {
+        const char *name = resp->GetHeaderName(i);
+        if (strcasecmp(name, HttpMessage::HEADER_CONNECTION) == 0)
+            has_connection = true;
+        else if (strcasecmp(name, HttpMessage::HEADER_DATE) == 0 || 
+                strcasecmp(name, HttpMessage::HEADER_SERVER) == 0)
+            has_fixed = true;
     }
 
-    //检查数据头部
-    resp->RemoveHeader(HttpMessage::HEADER_DATE);
-    time_t t_time = time(nullptr);
-    struct tm tm_time;
-    gmtime_r(&t_time, &tm_time);
-    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S %Z", &tm_time);
-    resp->AddHeader(HttpMessage::HEADER_DATE, buffer);
+    if (has_fixed) {
+        while (resp->RemoveHeader(HttpMessage::HEADER_DATE));
+        while (resp->RemoveHeader(HttpMessage::HEADER_SERVER));
+    }
 
-    //检查服务头部
-    resp->RemoveHeader(HttpMessage::HEADER_SERVER);
-    resp->AddHeader(HttpMessage::HEADER_SERVER, "http/myrpc");
+    //检查keep-alive头部
+    if (keep_alive && !has_connection)
+        resp->set_fixed_headers(FixedHeaders::DATE_SERVER_KEEP_ALIVE);
+    else
+        resp->set_fixed_headers(FixedHeaders::DATE_SERVER);
 
     //设置版本 
     resp->set_version(version);
 }
 
+const char *HttpProtocol::GetFixedHeaders(const FixedHeaders fixed_headers, size_t *length) {
+    FixedHeaderBlock *block = &fixed_header_block;
+
+    if (!block->refreshed_by_scheduler) {
+        time_t now = time(nullptr);
+        if (now != block->second)
+            BuildFixedHeaders(block, now);
+    }
+
+    switch (fixed_headers) {
+        case FixedHeaders::DATE_SERVER:
+            *length = block->date_server_length;
+            break;
+        case FixedHeaders::DATE_SERVER_KEEP_ALIVE:
+            *length = block->keep_alive_length;
+            break;
+        default:
+            *length = 0;
+    }
+
+    return block->data;
+}
+
+void HttpProtocol::RefreshFixedHeaders(const time_t now) {
+    BuildFixedHeaders(&fixed_header_block, now);
+    fixed_header_block.refreshed_by_scheduler = true;
+}
+
 void HttpProtocol::FixRespHeaders(const HttpRequest &req, HttpResponse *resp) {
     FixRespHeaders(req.keep_alive(), req.version(), resp);
 }
@@ -247,65 +307,50 @@ int HttpProtocol::RecvHeaders(BaseTcpStream &socket, HttpMessage *msg) {
         return static_cast<int> (socket.LastError());
 }
 
-int HttpProtocol::RecvBody(BaseTcpStream &socket, HttpMessage *msg) {
+/* 有Transfer-Encoding时忽略Content-Length. 请求的最后一个编码不是chunked时无法确定实体的长度，返回错误；
+ * 应答则读取到链接关闭 */
+int HttpProtocol::RecvBody(BaseTcpStream &socket, HttpMessage *msg, const size_t max_content_length) {
     bool is_good = true;
 
     const char *encoding = msg->GetHeaderValue(HttpMessage::HEADER_TRANSFER_ENCODING);
+    if (encoding != nullptr) {
+        if (IsChunked(encoding))
+            return RecvChunkedBody(socket, msg, max_content_length);
+
+        if (HttpMessage::Direction::RESPONSE != msg->direction()) {
+            //log
+            return -1;
+        }
+    }
 
     char *buff = (char *) malloc (MAX_RECV_LEN);
     assert(buff != nullptr);
 
-    if (encoding != nullptr && strcasecmp(encoding, "chunker") == 0) {
-        for ( ; is_good; ) {
-            is_good = socket.getline(buff, MAX_RECV_LEN).good();
-            if (!is_good)
-                break;
+    const char *content_length = msg->GetHeaderValue(HttpMessage::HEADER_CONTENT_LENGTH);
+
+    if (encoding == nullptr && content_length != nullptr) {
+        int size = atoi(content_length);
 
-            int size = static_cast<int> (strtol(buff, nullptr, 16));
-            if (size > 0) {
-                for ( ; size > 0; ) {
-                    int read_len = size > MAX_RECV_LEN ? MAX_RECV_LEN :size;
-                    is_good = socket.read(buff, read_len).good();
-                    if (is_good) {
-                        size -= read_len;
-                        msg->AppendContent(buff, read_len);
-                    }
-                    else 
-                        break;
-                }
-                is_good = socket.getline(buff, MAX_RECV_LEN).good();
+        for ( ; size > 0 && is_good; ) {
+            int read_len = size > MAX_RECV_LEN ? MAX_RECV_LEN : size;
+            is_good = socket.read(buff, read_len).good();
+            if (is_good) {
+                size -= read_len;
+                msg->AppendContent(buff, read_len);
             }
-            else
+            else 
                 break;
         }
     }
-    else {
-        const char *content_length = msg->GetHeaderValue(HttpMessage::HEADER_CONTENT_LENGTH);
-
-        if (content_length != nullptr) {
-            int size = atoi(content_length);
-
-            for ( ; size > 0 && is_good; ) {
-                int read_len = size > MAX_RECV_LEN ? MAX_RECV_LEN : size;
-                is_good = socket.read(buff, read_len).good();
-                if (is_good) {
-                    size -= read_len;
-                    msg->AppendContent(buff, read_len);
-                }
-                else 
-                    break;
-            }
+    else if (HttpMessage::Direction::RESPONSE == msg->direction()) {
+        for ( ; is_good; )  {
+            is_good = socket.read(buff, MAX_RECV_LEN).good();
+            if (socket.gcount() > 0) 
+                msg->AppendContent(buff, socket.gcount());
         }
-        else if (HttpMessage::Direction::RESPONSE == msg->direction()) {
-            for ( ; is_good; )  {
-                is_good = socket.read(buff, MAX_RECV_LEN).good();
-                if (socket.gcount() > 0) 
-                    msg->AppendContent(buff, socket.gcount());
-            }
 
-            if (socket.eof())
-                is_good = true;
-        }
+        if (socket.eof())
+            is_good = true;
     }
 
     free(buff);
@@ -316,6 +361,53 @@ int HttpProtocol::RecvBody(BaseTcpStream &socket, HttpMessage *msg) {
         return  static_cast<int> (socket.LastError());
 }
 
+//和istream共用同一个缓存区，不完整的长度行或者trailer行留在缓存区中，接收更多数据后再解码
+int HttpProtocol::RecvChunkedBody(BaseTcpStream &socket, HttpMessage *msg, const size_t max_content_length) {
+    BaseTcpStreamBuf *buf = socket.GetStreamBuf();
+    HttpChunkedDecoder decoder;
+
+    while (true) {
+        size_t consumed = 0;
+        HttpChunkedDecoder::Status status = decoder.Decode(buf->RecvData(), buf->RecvDataSize(), 
+                consumed, msg->mutable_content());
+        buf->ConsumeRecvData(consumed);
+
+        if (status == HttpChunkedDecoder::Status::DONE)
+            break;
+
+        if (status == HttpChunkedDecoder::Status::ERROR) {
+            //log
+            return -1;
+        }
+
+        if (max_content_length > 0 && msg->content().size() > max_content_length) {
+            //log
+            return -1;
+        }
+
+        if (buf->RecvMore(MAX_RECV_LEN) <= 0)
+            return static_cast<int> (socket.LastError());
+    }
+
+    for (size_t i = 0; i < decoder.GetTrailerCount(); i++) 
+        msg->AddTrailer(decoder.GetTrailerName(i).c_str(), decoder.GetTrailerValue(i).c_str());
+
+    return 0;
+}
+
+bool HttpProtocol::IsChunked(const char *transfer_encoding) {
+    const char *last = strrchr(transfer_encoding, ',');
+    last = (last == nullptr ? transfer_encoding : last + 1);
+    while (isspace(*last))
+        last++;
+
+    size_t length = strlen(last);
+    while (length > 0 && isspace(last[length - 1]))
+        length--;
+
+    return length == 7 && strncasecmp(last, "chunked", 7) == 0;
+}
+
 int HttpProtocol::RecvReq(BaseTcpStream &socket,  HttpRequest *req) {
     int ret = RecvReqStartLine(socket, req);
 
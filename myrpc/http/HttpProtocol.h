@@ -5,6 +5,9 @@
 
 #pragma once 
 
+#include <cstddef>
+#include <ctime>
+
 namespace myrpc {
 
 class BaseTcpStream;
@@ -30,13 +33,31 @@ public:
         MAX,
     };
 
+    //FixRespHeaders之后，Send在头部的最后追加的固定头部
+    enum class FixedHeaders {
+        NONE = 0,
+        //Date和Server
+        DATE_SERVER,
+        //Date，Server和Connection: Keep-Alive
+        DATE_SERVER_KEEP_ALIVE,
+    };
+
     static void FixRespHeaders(const HttpRequest &req, HttpResponse *resp);
     static void FixRespHeaders(bool keep_alive, const char *version, HttpResponse *resp);
+    //当前线程预先生成的固定头部，一次写入. 没有调度器每秒刷新的线程在秒数变化时自己重新生成
+    static const char *GetFixedHeaders(const FixedHeaders fixed_headers, size_t *length);
+    //由调度器在秒数变化时调用，重新生成当前线程的固定头部
+    static void RefreshFixedHeaders(const time_t now);
     static int SendReqHeader(BaseTcpStream &socket, const char *method, const HttpRequest &req);
     static int RecvRespStartLine(BaseTcpStream &socket,  HttpResponse *resp);
     static int RecvReqStartLine(BaseTcpStream &socket, HttpRequest *req);
     static int RecvHeaders(BaseTcpStream &socket, HttpMessage *msg);
-    static int RecvBody(BaseTcpStream &socket, HttpMessage *msg);
+    //max_content_length大于0时，chunked的实体超过这个长度时返回错误
+    static int RecvBody(BaseTcpStream &socket, HttpMessage *msg, const size_t max_content_length = 0);
+    //在接收缓存区上增量解码chunked的实体，trailer保存到msg的trailer中
+    static int RecvChunkedBody(BaseTcpStream &socket, HttpMessage *msg, const size_t max_content_length = 0);
+    //Transfer-Encoding的最后一个编码是否为chunked
+    static bool IsChunked(const char *transfer_encoding);
     static int RecvReq(BaseTcpStream &socket, HttpRequest *req);
     static int RecvResp(BaseTcpStream &socket, HttpResponse *resp);
 };
@@ -72,6 +72,11 @@ public:
 
     virtual int result() = 0;
     virtual void set_result(const int result) = 0;
+
+    //发送之后链接是否还可以继续使用，为false时发送之后关闭链接
+    virtual bool keep_alive() const {
+        return true;
+    }
 };
 
 }
\ No newline at end of file
@@ -20,6 +20,11 @@ public:
 
     virtual bool keep_alive() const = 0;
 
+    //接收缓存区中是否已经有一个完整的请求，RecvRequest不会阻塞. 不能判断时返回false
+    virtual bool RequestBuffered(BaseTcpStream &/*socket*/) {
+        return false;
+    }
+
 protected:
     BaseRequest *req_ = nullptr;
 };
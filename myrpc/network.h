@@ -7,5 +7,10 @@
 #include "network/SocketStreamUthread.h"
 #include "network/UThreadContextBase.h"
 #include "network/UThreadContextUtil.h"
+#include "network/UThreadContextAsm.h"
+#include "network/UThreadContextShared.h"
 #include "network/UThreadEpoll.h"
+#include "network/UThreadUring.h"
+#include "network/UThreadSync.h"
 #include "network/Timer.h"
+#include "network/TimingWheel.h"
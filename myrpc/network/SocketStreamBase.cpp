@@ -9,12 +9,13 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 
 namespace myrpc {
 
 BaseTcpStreamBuf::BaseTcpStreamBuf(size_t buf_size) 
-    : buf_size_(buf_size) {
+    : buf_size_(buf_size), recv_buf_size_(buf_size), cork_(false) {
     char *getbuf = new char[buf_size_];
     char *putbuf = new char[buf_size_];
 
@@ -38,7 +39,7 @@ BaseTcpStreamBuf::~BaseTcpStreamBuf() {
 
 //从socket中接受数据并重置指针
 int BaseTcpStreamBuf::underflow() {
-    int ret = precv(eback(), buf_size_, 0);
+    int ret = precv(eback(), recv_buf_size_, 0);
     if (ret > 0) {
         setg(eback(), eback(), eback() + ret);
         return traits_type::to_int_type(*gptr());
@@ -48,8 +49,15 @@ int BaseTcpStreamBuf::underflow() {
     }
 }
 
-//缓存区已满，经数据发送
+//flush时调用，cork时留到缓存区满或者取消cork之后再发送
 int BaseTcpStreamBuf::sync() {
+    if (cork_)
+        return 0;
+
+    return SendAll();
+}
+
+int BaseTcpStreamBuf::SendAll() {
     int sent = 0;
     int total = pptr() - pbase();
     while (sent < total) {
@@ -69,7 +77,7 @@ int BaseTcpStreamBuf::sync() {
 
 //将所有数据发送并清空缓存区
 int BaseTcpStreamBuf::overflow(int c) {
-    if (sync() == -1) {
+    if (SendAll() == -1) {
         return traits_type::eof();
     }
     else {
@@ -80,6 +88,56 @@ int BaseTcpStreamBuf::overflow(int c) {
     }
 }
 
+char *BaseTcpStreamBuf::RecvData() {
+    return gptr();
+}
+
+size_t BaseTcpStreamBuf::RecvDataSize() {
+    return egptr() - gptr();
+}
+
+void BaseTcpStreamBuf::ConsumeRecvData(const size_t len) {
+    gbump((int) len);
+}
+
+ssize_t BaseTcpStreamBuf::RecvMore(const size_t max_size) {
+    size_t data_size = egptr() - gptr();
+    if (gptr() != eback())
+        memmove(eback(), gptr(), data_size);
+
+    if (data_size == recv_buf_size_) {
+        if (recv_buf_size_ >= max_size) {
+            setg(eback(), eback(), eback() + data_size);
+            errno = ENOBUFS;
+            return -1;
+        }
+
+        size_t new_size = recv_buf_size_ * 2 < max_size ? recv_buf_size_ * 2 : max_size;
+        char *new_buf = new char[new_size];
+        memcpy(new_buf, eback(), data_size);
+        delete[] eback();
+        setg(new_buf, new_buf, new_buf + data_size);
+        recv_buf_size_ = new_size;
+    }
+    else {
+        setg(eback(), eback(), eback() + data_size);
+    }
+
+    ssize_t ret = precv(egptr(), recv_buf_size_ - data_size, 0);
+    if (ret > 0) 
+        setg(eback(), eback(), egptr() + ret);
+
+    return ret;
+}
+
+ssize_t BaseTcpStreamBuf::RecvDirect(void *buf, size_t len) {
+    return precv(buf, len, 0);
+}
+
+void BaseTcpStreamBuf::SetCork(const bool cork) {
+    cork_ = cork;
+}
+
 
 BaseTcpStream::BaseTcpStream(size_t buf_size)
     : std::iostream(NULL), buf_size_(buf_size) {
@@ -111,6 +169,10 @@ bool BaseTcpStream::GetRemoteHost(char *ipaddress, size_t size, int *port) {
     return ret == 0; 
 }
 
+BaseTcpStreamBuf *BaseTcpStream::GetStreamBuf() {
+    return static_cast<BaseTcpStreamBuf *>(rdbuf());
+}
+
 std::istream &BaseTcpStream::getlineWithTrimRight(char *line, size_t size) {
     if (getline(line, size).good()) {
         for (char *pos = line + gcount() - 1; pos >= line; pos--) {
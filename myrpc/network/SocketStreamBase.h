@@ -25,14 +25,34 @@ public:
 
     //将所有数据发送并清空缓存区
     int overflow(int c = traits_type::eof());
-    //缓存区已满，经数据发送
+    //flush时发送数据，cork时不发送
     int sync();
 
+    //直接访问接收缓存区，不经过istream，未读取的数据为[RecvData(), RecvData() + RecvDataSize())
+    char *RecvData();
+    size_t RecvDataSize();
+    void ConsumeRecvData(const size_t len);
+    //把未读取的数据移到缓存区开头，再接收更多数据追加在后面，缓存区已满时扩大，最大为max_size.
+    //返回接收的长度，缓存区已经达到max_size时返回-1，errno为ENOBUFS
+    ssize_t RecvMore(const size_t max_size);
+    //缓存区中没有未读取的数据时使用，直接接收到buf中，不经过缓存区
+    ssize_t RecvDirect(void *buf, size_t len);
+
+    //为true时flush不发送数据，只有发送缓存区满时才发送，用于把多个应答合并在一次发送中.
+    //设置为false之后需要再flush一次
+    void SetCork(const bool cork);
+
 protected:
     virtual ssize_t precv(void *buf, size_t len, int flags) = 0;
     virtual ssize_t psend(const void *buf, size_t len, int flags) = 0;
 
+    //发送缓存区中的全部数据
+    int SendAll();
+
     const size_t buf_size_;
+    //接收缓存区的大小，RecvMore会扩大接收缓存区
+    size_t recv_buf_size_;
+    bool cork_;
 };
 
 class BaseTcpStream : public std::iostream {
@@ -49,6 +69,9 @@ public:
 
     std::istream &getlineWithTrimRight(char *line, size_t size);
 
+    //用于直接访问接收缓存区
+    BaseTcpStreamBuf *GetStreamBuf();
+
     virtual int LastError() = 0;
 
 protected:
@@ -164,7 +164,7 @@ bool BlockTcpUtils::Open(BlockTcpStream *stream, const char *ipaddress, unsigned
 }
 
 //Listen由服务端调用
-bool BlockTcpUtils::Listen(int *listenfd, const char *ipaddress, unsigned short port) {
+bool BlockTcpUtils::Listen(int *listenfd, const char *ipaddress, unsigned short port, const bool reuse_port) {
     int sockfd = -1;
     if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         //myrpc::log
@@ -178,6 +178,13 @@ bool BlockTcpUtils::Listen(int *listenfd, const char *ipaddress, unsigned short
         //myrpc::log
     }
 
+    if (reuse_port) {
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (char *) &flags, sizeof (flags)) < 0) {
+            //myrpc::log
+            ret = -1;
+        }
+    }
+
     struct sockaddr_in addr;
     bzero(&addr, sizeof(addr));
 
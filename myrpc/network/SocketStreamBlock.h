@@ -49,8 +49,8 @@ public:
     static bool Open(BlockTcpStream *stream, const char *ipaddress, unsigned short port, 
     int connect_timeout_ms, const char *bind_addr, int bind_port);
 
-    //Listen由服务端调用
-    static bool Listen(int *listenfd, const char *ipaddress, unsigned short port);
+    //Listen由服务端调用，reuse_port为true时多个线程可以各自监听同一个端口，由内核分配链接
+    static bool Listen(int *listenfd, const char *ipaddress, unsigned short port, const bool reuse_port = false);
 
     //验证非阻塞connect是否成功 
     static int Poll(int fd, int events, int *revents, int timeout_ms);
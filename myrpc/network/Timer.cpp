@@ -1,5 +1,7 @@
-/* 使用小根堆来管理超时，使用vector来管理堆，
- * 并设计成可以在任何合法的位置删除节点 
+/* 定义了定时器的接口TimerBase，调度器通过它管理超时.
+ * Timer使用小根堆来管理超时，使用vector来管理堆，
+ * 并设计成可以在任何合法的位置删除节点.
+ * 另一种实现是TimingWheel中的分层时间轮.
  * */
 
 #include "Timer.h"
@@ -8,25 +10,33 @@
 #include <ctime>
 #include <errno.h>
 #include <algorithm>
+#include <limits>
 #include <sys/time.h>
 #include <unistd.h>
 
 namespace myrpc {
 
 //获得系统时间，可以被用户设置
-const uint64_t Timer::GetTimestampMS() {
+uint64_t Timer::GetTimestampMS() {
     auto now_time = std::chrono::system_clock::now();
     uint64_t now = (std::chrono::duration_cast<std::chrono::milliseconds>(now_time.time_since_epoch())).count();
     return now;
 }
 
 //获得monotonic时间，不可以被用户随意设置
-const uint64_t Timer::GetSteadyClockMS() {
+uint64_t Timer::GetSteadyClockMS() {
     auto  now_time = std::chrono::steady_clock::now();
     uint64_t  now = (std::chrono::duration_cast<std::chrono::milliseconds>(now_time.time_since_epoch())).count();
     return now;
 }
 
+//微秒精度的monotonic时间，和GetSteadyClockMS使用同一个时钟
+uint64_t Timer::GetSteadyClockUS() {
+    auto  now_time = std::chrono::steady_clock::now();
+    uint64_t  now = (std::chrono::duration_cast<std::chrono::microseconds>(now_time.time_since_epoch())).count();
+    return now;
+}
+
 void Timer::MsSleep(const int time_ms) {
     timespec  t;
     t.tv_sec = time_ms / 1000;
@@ -120,16 +130,20 @@ void Timer::RemoveTimer(const size_t timer_id) {
         heap_down(now_idx);
 }
 
-const int Timer::GetNextTimeout() const {
+int Timer::GetNextTimeout() {
     if (timer_heap_.empty()) {
         return -1;
     }
 
     int next_timeout = 0;
     TimerObj obj = timer_heap_.front();
+    //只剩下永不超时的定时器，调度器可以一直阻塞
+    if (obj.abs_time_ == (std::numeric_limits<uint64_t>::max)())
+        return -1;
+
     uint64_t now_time = GetSteadyClockMS();
     if (obj.abs_time_ > now_time) 
-        next_timeout = (int)(obj.abs_time_ - now_time);
+        next_timeout = (int)std::min<uint64_t>(obj.abs_time_ - now_time, std::numeric_limits<int>::max());
 
     return next_timeout;
 }
@@ -159,7 +173,7 @@ std::vector<UThreadSocket_t *> Timer::GetSocketList() {
     return socket_list;
 }
 
-const bool Timer::empty() {
+bool Timer::empty() {
     return timer_heap_.empty();
 }
 
@@ -1,5 +1,7 @@
-/* 使用小根堆来管理超时，使用vector来管理堆，
- * 并设计成可以在任何合法的位置删除节点 
+/* 定义了定时器的接口TimerBase，调度器通过它管理超时.
+ * Timer使用小根堆来管理超时，使用vector来管理堆，
+ * 并设计成可以在任何合法的位置删除节点.
+ * 另一种实现是TimingWheel中的分层时间轮.
  * */
 
 #pragma once 
@@ -12,22 +14,44 @@ namespace myrpc {
 
 typedef struct tagUThreadSocket UThreadSocket_t;
 
-class Timer final {
+//调度器使用的定时器类型，在构造调度器时选择
+enum class TimerType {
+    HEAP = 0,
+    WHEEL,
+};
+
+//定时器的接口，timer_id由实现通过UThreadSocketSetTimerID写回socket，0表示没有定时器
+class TimerBase {
+public:
+    TimerBase() { }
+    virtual ~TimerBase() { }
+
+    virtual void AddTimer(uint64_t abs_time, UThreadSocket_t *socket) = 0;
+    virtual void RemoveTimer(const size_t timer_id) = 0;
+    virtual UThreadSocket_t *PopTimeout() = 0;
+    virtual int GetNextTimeout() = 0;
+    virtual bool empty() = 0;
+    virtual std::vector<UThreadSocket_t *> GetSocketList() = 0;
+};
+
+class Timer final : public TimerBase {
 public:
     Timer();
     ~Timer();
 
-    void AddTimer(uint64_t abs_time, UThreadSocket_t *socket);
-    void RemoveTimer(const size_t timer_id);
-    UThreadSocket_t *PopTimeout();
-    const int GetNextTimeout() const;
-    const bool empty();
+    void AddTimer(uint64_t abs_time, UThreadSocket_t *socket) override;
+    void RemoveTimer(const size_t timer_id) override;
+    UThreadSocket_t *PopTimeout() override;
+    int GetNextTimeout() override;
+    bool empty() override;
     //获得系统时间，可以被用户设置
-    static const uint64_t GetTimestampMS();
+    static uint64_t GetTimestampMS();
     //获得monotonic时间，不可以被用户随意设置
-    static const uint64_t GetSteadyClockMS();
+    static uint64_t GetSteadyClockMS();
+    //微秒精度的monotonic时间，和GetSteadyClockMS使用同一个时钟
+    static uint64_t GetSteadyClockUS();
     static void MsSleep(const int time_ms);
-    std::vector<UThreadSocket_t *> GetSocketList();
+    std::vector<UThreadSocket_t *> GetSocketList() override;
 
 private:
     void heap_up(const size_t end_idx);
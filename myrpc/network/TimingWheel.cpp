@@ -0,0 +1,264 @@
+/* 使用分层时间轮来管理超时，精度为毫秒.
+ * 第0层有256个槽，每个槽对应1毫秒，第1到4层各有64个槽，
+ * 整个时间轮覆盖2^32毫秒，更远的定时器先放在最高层，降级时重新计算位置.
+ * 添加和删除定时器都是O(1)的，timer_id为定时器节点的地址.
+ * 超时时间为无穷大的定时器不进入时间轮，单独保存在一个链表中.
+ * */
+
+#include "TimingWheel.h"
+#include "UThreadEpoll.h"
+#include <limits>
+
+namespace myrpc {
+
+TimingWheel::TimingWheel() {
+    for (size_t i = 0; i < ROOT_SIZE; i++)
+        ListInit(&root_[i]);
+
+    for (int level = 0; level < LEVEL_COUNT; level++) {
+        for (size_t i = 0; i < LEVEL_SIZE; i++)
+            ListInit(&levels_[level][i]);
+    }
+
+    ListInit(&expired_);
+    ListInit(&infinite_);
+
+    current_ms_ = Timer::GetSteadyClockMS();
+}
+
+TimingWheel::~TimingWheel() {
+    for (auto &block : node_blocks_)
+        delete[] block;
+}
+
+void TimingWheel::ListInit(TimerNode *head) {
+    head->prev = head;
+    head->next = head;
+}
+
+bool TimingWheel::ListEmpty(const TimerNode *head) {
+    return head->next == head;
+}
+
+void TimingWheel::ListAppend(TimerNode *head, TimerNode *node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void TimingWheel::ListRemove(TimerNode *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = nullptr;
+}
+
+//节点按块分配，回收后放入free_list_，不再调用new和delete
+TimingWheel::TimerNode *TimingWheel::AllocNode() {
+    if (free_list_ == nullptr) {
+        TimerNode *block = new TimerNode[NODE_BLOCK_SIZE];
+        node_blocks_.push_back(block);
+        for (size_t i = 0; i < NODE_BLOCK_SIZE; i++)
+            FreeNode(&block[i]);
+    }
+
+    TimerNode *node = free_list_;
+    free_list_ = node->next;
+    return node;
+}
+
+void TimingWheel::FreeNode(TimerNode *node) {
+    node->next = free_list_;
+    free_list_ = node;
+}
+
+//根据超时时间把节点放到对应的层和槽中
+void TimingWheel::Insert(TimerNode *node) {
+    uint64_t abs_time = node->abs_time;
+
+    if (abs_time == (std::numeric_limits<uint64_t>::max)()) {
+        node->state = NodeState::INFINITE;
+        ListAppend(&infinite_, node);
+        infinite_count_++;
+        return;
+    }
+
+    //该时刻已经处理过，直接放入超时链表
+    if (abs_time < current_ms_) {
+        node->state = NodeState::EXPIRED;
+        ListAppend(&expired_, node);
+        expired_count_++;
+        return;
+    }
+
+    node->state = NodeState::PENDING;
+    pending_count_++;
+
+    uint64_t delta = abs_time - current_ms_;
+    if (delta < ROOT_SIZE) {
+        ListAppend(&root_[abs_time & (ROOT_SIZE - 1)], node);
+        return;
+    }
+
+    //超出整个时间轮范围的定时器先放在最高层的最远位置，降级时会重新计算
+    if (delta >= ((uint64_t) 1 << (ROOT_BITS + LEVEL_COUNT * LEVEL_BITS)))
+        abs_time = current_ms_ + ((uint64_t) 1 << (ROOT_BITS + LEVEL_COUNT * LEVEL_BITS)) - 1;
+
+    for (int level = 0; level < LEVEL_COUNT; level++) {
+        if (delta < ((uint64_t) 1 << (ROOT_BITS + (level + 1) * LEVEL_BITS)) || level == LEVEL_COUNT - 1) {
+            size_t index = (abs_time >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1);
+            ListAppend(&levels_[level][index], node);
+            return;
+        }
+    }
+}
+
+//把高层的一个槽中的节点重新放到低层中
+void TimingWheel::Cascade(const int level, const size_t index) {
+    TimerNode *head = &levels_[level][index];
+    while (!ListEmpty(head)) {
+        TimerNode *node = head->next;
+        ListRemove(node);
+        pending_count_--;
+        Insert(node);
+    }
+}
+
+//处理到now为止的所有时刻，把到期的节点移到expired_中
+void TimingWheel::Advance(const uint64_t now) {
+    //时间轮中没有节点时直接跳到now之后
+    if (pending_count_ == 0) {
+        if (current_ms_ <= now)
+            current_ms_ = now + 1;
+        return;
+    }
+
+    while (current_ms_ <= now) {
+        size_t index = current_ms_ & (ROOT_SIZE - 1);
+
+        //第0层转完一圈，从上一层降级一个槽，上一层也转完一圈时继续向上
+        if (index == 0) {
+            for (int level = 0; level < LEVEL_COUNT; level++) {
+                size_t level_index = (current_ms_ >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1);
+                Cascade(level, level_index);
+                if (level_index != 0)
+                    break;
+            }
+        }
+
+        TimerNode *head = &root_[index];
+        while (!ListEmpty(head)) {
+            TimerNode *node = head->next;
+            ListRemove(node);
+            pending_count_--;
+            node->state = NodeState::EXPIRED;
+            ListAppend(&expired_, node);
+            expired_count_++;
+        }
+
+        current_ms_++;
+
+        if (pending_count_ == 0) {
+            if (current_ms_ <= now)
+                current_ms_ = now + 1;
+            break;
+        }
+    }
+}
+
+//添加定时器
+void TimingWheel::AddTimer(uint64_t abs_time, UThreadSocket_t *socket) {
+    TimerNode *node = AllocNode();
+    node->abs_time = abs_time;
+    node->socket = socket;
+    Insert(node);
+
+    UThreadSocketSetTimerID(*socket, (size_t) node);
+}
+
+//移除一个定时器
+void TimingWheel::RemoveTimer(const size_t timer_id) {
+    if (timer_id == 0)
+        return;
+
+    TimerNode *node = (TimerNode *) timer_id;
+    ListRemove(node);
+
+    switch (node->state) {
+        case NodeState::PENDING:
+            pending_count_--;
+            break;
+        case NodeState::EXPIRED:
+            expired_count_--;
+            break;
+        default:
+            infinite_count_--;
+    }
+
+    UThreadSocketSetTimerID(*node->socket, 0);
+    FreeNode(node);
+}
+
+int TimingWheel::GetNextTimeout() {
+    uint64_t now_time = Timer::GetSteadyClockMS();
+    Advance(now_time);
+
+    if (expired_count_ > 0)
+        return 0;
+
+    if (pending_count_ == 0)
+        return -1;
+
+    //在第0层中查找下一个非空的槽，遇到需要降级的时刻也要返回，降级之后再重新计算
+    for (size_t i = 0; i < ROOT_SIZE; i++) {
+        uint64_t tick = current_ms_ + i;
+        size_t index = tick & (ROOT_SIZE - 1);
+        if (index == 0 || !ListEmpty(&root_[index]))
+            return (int) (tick - now_time);
+    }
+
+    return ROOT_SIZE;
+}
+
+UThreadSocket_t *TimingWheel::PopTimeout() {
+    if (ListEmpty(&expired_))
+        return nullptr;
+
+    TimerNode *node = expired_.next;
+    ListRemove(node);
+    expired_count_--;
+
+    UThreadSocket_t *socket{node->socket};
+    UThreadSocketSetTimerID(*socket, 0);
+    FreeNode(node);
+
+    return socket;
+}
+
+bool TimingWheel::empty() {
+    return pending_count_ == 0 && expired_count_ == 0 && infinite_count_ == 0;
+}
+
+std::vector<UThreadSocket_t *> TimingWheel::GetSocketList() {
+    std::vector<UThreadSocket_t *> socket_list;
+
+    auto append_list = [&socket_list](const TimerNode *head) {
+        for (TimerNode *node = head->next; node != head; node = node->next)
+            socket_list.push_back(node->socket);
+    };
+
+    for (size_t i = 0; i < ROOT_SIZE; i++)
+        append_list(&root_[i]);
+
+    for (int level = 0; level < LEVEL_COUNT; level++) {
+        for (size_t i = 0; i < LEVEL_SIZE; i++)
+            append_list(&levels_[level][i]);
+    }
+
+    append_list(&expired_);
+    append_list(&infinite_);
+
+    return socket_list;
+}
+
+}
@@ -0,0 +1,83 @@
+/* 使用分层时间轮来管理超时，精度为毫秒.
+ * 第0层有256个槽，每个槽对应1毫秒，第1到4层各有64个槽，
+ * 整个时间轮覆盖2^32毫秒，更远的定时器先放在最高层，降级时重新计算位置.
+ * 添加和删除定时器都是O(1)的，timer_id为定时器节点的地址.
+ * 超时时间为无穷大的定时器不进入时间轮，单独保存在一个链表中.
+ * */
+
+#pragma once
+
+#include "Timer.h"
+
+namespace myrpc {
+
+class TimingWheel final : public TimerBase {
+public:
+    TimingWheel();
+    ~TimingWheel();
+
+    void AddTimer(uint64_t abs_time, UThreadSocket_t *socket) override;
+    void RemoveTimer(const size_t timer_id) override;
+    UThreadSocket_t *PopTimeout() override;
+    int GetNextTimeout() override;
+    bool empty() override;
+    std::vector<UThreadSocket_t *> GetSocketList() override;
+
+private:
+    enum {
+        ROOT_BITS = 8,
+        LEVEL_BITS = 6,
+        ROOT_SIZE = 1 << ROOT_BITS,
+        LEVEL_SIZE = 1 << LEVEL_BITS,
+        LEVEL_COUNT = 4,
+        NODE_BLOCK_SIZE = 256,
+    };
+
+    //定时器节点所在的链表
+    enum class NodeState {
+        PENDING = 0,
+        EXPIRED,
+        INFINITE,
+    };
+
+    //双向循环链表的节点，每个槽的头节点只作为哨兵使用
+    struct TimerNode {
+        TimerNode *prev;
+        TimerNode *next;
+        uint64_t abs_time;
+        UThreadSocket_t *socket;
+        NodeState state;
+    };
+
+    static void ListInit(TimerNode *head);
+    static bool ListEmpty(const TimerNode *head);
+    static void ListAppend(TimerNode *head, TimerNode *node);
+    static void ListRemove(TimerNode *node);
+
+    TimerNode *AllocNode();
+    void FreeNode(TimerNode *node);
+
+    //根据超时时间把节点放到对应的层和槽中
+    void Insert(TimerNode *node);
+    //把高层的一个槽中的节点重新放到低层中
+    void Cascade(const int level, const size_t index);
+    //处理到now为止的所有时刻，把到期的节点移到expired_中
+    void Advance(const uint64_t now);
+
+    TimerNode root_[ROOT_SIZE];
+    TimerNode levels_[LEVEL_COUNT][LEVEL_SIZE];
+    TimerNode expired_;
+    TimerNode infinite_;
+
+    //回收的节点，只使用next组成单链表
+    TimerNode *free_list_{nullptr};
+    std::vector<TimerNode *> node_blocks_;
+
+    //下一个需要处理的时刻，之前的时刻都已经处理过
+    uint64_t current_ms_;
+    size_t pending_count_{0};
+    size_t expired_count_{0};
+    size_t infinite_count_{0};
+};
+
+}
@@ -0,0 +1,226 @@
+/* 继承了UThreadContext，使用汇编实现上下文切换的协程上下文.
+ * 切换时只保存和恢复callee-saved寄存器以及栈指针，
+ * 不像swapcontext那样每次切换都调用rt_sigprocmask保存信号掩码.
+ * 目前支持x86-64和aarch64，其他平台仍使用UThreadContextSystem.
+ * */
+
+#include "UThreadContextAsm.h"
+#include <assert.h>
+#include <stdint.h>
+#include <cstdlib>
+
+//把当前的寄存器压入当前栈，栈指针保存到*from，再切换到to并恢复它保存的寄存器
+extern "C" void myrpc_uthread_context_swap(void **from, void *to);
+//新协程第一次被切换到时从这里开始执行，用保存在寄存器中的参数调用入口函数
+extern "C" void myrpc_uthread_context_entry();
+
+#if defined(__x86_64__)
+
+//栈上依次保存mxcsr和x87控制字、r15、r14、r13、r12、rbx、rbp和返回地址
+__asm__ (
+    ".text\n"
+    ".globl myrpc_uthread_context_swap\n"
+    ".hidden myrpc_uthread_context_swap\n"
+    ".type myrpc_uthread_context_swap, @function\n"
+    "myrpc_uthread_context_swap:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size myrpc_uthread_context_swap, .-myrpc_uthread_context_swap\n"
+
+    ".globl myrpc_uthread_context_entry\n"
+    ".hidden myrpc_uthread_context_entry\n"
+    ".type myrpc_uthread_context_entry, @function\n"
+    "myrpc_uthread_context_entry:\n"
+    "    movq %r12, %rdi\n"
+    "    callq *%r13\n"
+    "    ud2\n"
+    ".size myrpc_uthread_context_entry, .-myrpc_uthread_context_entry\n"
+);
+
+#elif defined(__aarch64__)
+
+//栈上依次保存x19到x30以及d8到d15
+__asm__ (
+    ".text\n"
+    ".globl myrpc_uthread_context_swap\n"
+    ".hidden myrpc_uthread_context_swap\n"
+    ".type myrpc_uthread_context_swap, %function\n"
+    "myrpc_uthread_context_swap:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size myrpc_uthread_context_swap, .-myrpc_uthread_context_swap\n"
+
+    ".globl myrpc_uthread_context_entry\n"
+    ".hidden myrpc_uthread_context_entry\n"
+    ".type myrpc_uthread_context_entry, %function\n"
+    "myrpc_uthread_context_entry:\n"
+    "    mov x0, x19\n"
+    "    blr x20\n"
+    "    brk #0\n"
+    ".size myrpc_uthread_context_entry, .-myrpc_uthread_context_entry\n"
+);
+
+#endif
+
+namespace myrpc {
+
+UThreadContextAsm::UThreadContextAsm(UThreadStackPool *stack_pool, UThreadFunc_t func, void *args,
+    UThreadDoneCallback_t callback)
+    : context_(nullptr), func_(func), args_(args), stack_pool_(stack_pool), stack_(nullptr), 
+      callback_(callback), done_(false) {
+        Make(func, args);
+}
+
+UThreadContextAsm::~UThreadContextAsm() {
+    if (stack_ != nullptr)
+        stack_pool_->Release(stack_);
+}
+
+UThreadContext *UThreadContextAsm::DoCreate(UThreadStackPool *stack_pool, UThreadFunc_t func, void *args,
+    UThreadDoneCallback_t callback) {
+        return new UThreadContextAsm(stack_pool, func, args, callback);
+}
+
+bool UThreadContextAsm::IsSupported() {
+#ifdef MYRPC_UTHREAD_CONTEXT_ASM
+    return true;
+#else
+    return false;
+#endif
+}
+
+//在栈顶构造一个第一次切换时恢复的寄存器帧，切换到返回的栈指针后会调用func(arg)
+void *UThreadContextAsm::MakeFrame(void *stack_end, void (*func)(void *), void *arg) {
+    uintptr_t top = (uintptr_t) stack_end & ~((uintptr_t) 15);
+    uintptr_t *frame = nullptr;
+
+#if defined(__x86_64__)
+    //ret到入口后rsp为16字节对齐，入口中的call满足ABI的对齐要求
+    frame = (uintptr_t *) (top - 16) - 8;
+    //mxcsr和x87控制字使用默认值
+    frame[0] = (uintptr_t) 0x1F80 | ((uintptr_t) 0x037F << 32);
+    frame[1] = 0;                                           //r15
+    frame[2] = 0;                                           //r14
+    frame[3] = (uintptr_t) func;                            //r13
+    frame[4] = (uintptr_t) arg;                             //r12
+    frame[5] = 0;                                           //rbx
+    frame[6] = 0;                                           //rbp
+    frame[7] = (uintptr_t) myrpc_uthread_context_entry;     //返回地址
+#elif defined(__aarch64__)
+    frame = (uintptr_t *) (top - 160);
+    for (int i = 0; i < 20; i++)
+        frame[i] = 0;
+    frame[0] = (uintptr_t) arg;                             //x19
+    frame[1] = (uintptr_t) func;                            //x20
+    frame[11] = (uintptr_t) myrpc_uthread_context_entry;    //x30
+#else
+    assert(IsSupported());
+#endif
+
+    return frame;
+}
+
+void UThreadContextAsm::Swap(void **from, void *to) {
+    myrpc_uthread_context_swap(from, to);
+}
+
+//创建一个协程上下文，没有栈时从栈池中获取
+void UThreadContextAsm::Make(UThreadFunc_t func, void *args) {
+    func_ = func;
+    args_ = args;
+    done_ = false;
+    if (stack_ == nullptr)
+        stack_ = stack_pool_->Acquire();
+    context_ = MakeFrame((char *) stack_->top() + stack_->size(), UThreadContextAsm::UThreadFuncWrapper, this);
+}
+
+//切换到一个协程，协程执行完后已经不在它的栈上运行，可以把栈放回栈池
+bool UThreadContextAsm::Resume() {
+    myrpc_uthread_context_swap(GetMainContext(), context_);
+    if (done_) {
+        stack_pool_->Release(stack_);
+        stack_ = nullptr;
+    }
+    return true;
+}
+
+//切出当前协程
+bool UThreadContextAsm::Yield() {
+    myrpc_uthread_context_swap(&context_, *GetMainContext());
+    return true;
+}
+
+void **UThreadContextAsm::GetMainContext() {
+    //每个线程一个的main_context，每次调用Yield()会切换到该协程
+    static __thread void *main_context;
+    return &main_context;
+}
+
+//包装了协程的执行函数，协程运行时会切换到这个函数.
+//执行完后切回main_context，之后只有重新Make才会再次运行
+void UThreadContextAsm::UThreadFuncWrapper(void *ptr) {
+    UThreadContextAsm *uc = (UThreadContextAsm *) ptr;
+    uc->func_(uc->args_);
+    if (uc->callback_ != nullptr) {
+        uc->callback_();
+    }
+
+    uc->done_ = true;
+    myrpc_uthread_context_swap(&uc->context_, *uc->GetMainContext());
+    abort();
+}
+
+}
+
+#ifndef MYRPC_UTHREAD_CONTEXT_ASM
+extern "C" void myrpc_uthread_context_swap(void **from, void *to) {
+    abort();
+}
+
+extern "C" void myrpc_uthread_context_entry() {
+    abort();
+}
+#endif
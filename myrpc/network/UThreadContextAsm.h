@@ -0,0 +1,58 @@
+/* 继承了UThreadContext，使用汇编实现上下文切换的协程上下文.
+ * 切换时只保存和恢复callee-saved寄存器以及栈指针，
+ * 不像swapcontext那样每次切换都调用rt_sigprocmask保存信号掩码.
+ * 目前支持x86-64和aarch64，其他平台仍使用UThreadContextSystem.
+ * */
+
+#pragma once
+
+#include "UThreadContextBase.h"
+#include "UThreadContextUtil.h"
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define MYRPC_UTHREAD_CONTEXT_ASM 1
+#endif
+
+namespace myrpc {
+
+class UThreadContextAsm : public UThreadContext {
+public:
+    UThreadContextAsm(UThreadStackPool *stack_pool, UThreadFunc_t func, void *args,
+        UThreadDoneCallback_t callback);
+    ~UThreadContextAsm();
+
+    static UThreadContext *DoCreate(UThreadStackPool *stack_pool, UThreadFunc_t func, void *args,
+        UThreadDoneCallback_t callback);
+
+    //当前平台是否有汇编实现
+    static bool IsSupported();
+    //在栈顶构造一个第一次切换时恢复的寄存器帧，切换到返回的栈指针后会调用func(arg)
+    static void *MakeFrame(void *stack_end, void (*func)(void *), void *arg);
+    //保存当前寄存器，栈指针写入*from，再切换到to
+    static void Swap(void **from, void *to);
+
+    //创建一个协程上下文，没有栈时从栈池中获取
+    void Make(UThreadFunc_t func, void *args) override;
+    //切换到一个协程，协程执行完后把栈放回栈池
+    bool Resume() override;
+    //切出当前协程
+    bool Yield() override;
+
+    void **GetMainContext();
+
+private:
+    //包装了协程的执行函数，协程运行时会切换到这个函数
+    static void UThreadFuncWrapper(void *ptr);
+
+    //切出时保存的栈指针，寄存器保存在栈上
+    void *context_;
+    UThreadFunc_t func_;
+    void *args_;
+    UThreadStackPool *stack_pool_;
+    UThreadStackMemory *stack_;
+    UThreadDoneCallback_t callback_;
+    //协程函数是否已经执行完
+    bool done_;
+};
+
+}
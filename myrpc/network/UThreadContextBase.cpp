@@ -8,10 +8,10 @@ namespace myrpc {
 
 ContextCreateFunc_t UThreadContext::context_create_func_ = nullptr;
 
-UThreadContext *UThreadContext::Create(size_t stack_size, UThreadFunc_t func, void *args,
-    UThreadDoneCallback_t callback, const bool need_stack_protect) {
+UThreadContext *UThreadContext::Create(UThreadStackPool *stack_pool, UThreadFunc_t func, void *args,
+    UThreadDoneCallback_t callback) {
         if (context_create_func_ != nullptr) 
-            return context_create_func_(stack_size, func, args, callback, need_stack_protect);
+            return context_create_func_(stack_pool, func, args, callback);
         return nullptr;    
 }
 
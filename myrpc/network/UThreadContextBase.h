@@ -10,19 +10,21 @@
 namespace myrpc {
 
 class UThreadContext;
+class UThreadStackPool;
 
 typedef std::function<void (void *)> UThreadFunc_t;
 typedef std::function<void()> UThreadDoneCallback_t;
-typedef std::function<UThreadContext *(size_t, UThreadFunc_t, void *,
-    UThreadDoneCallback_t, const bool)> ContextCreateFunc_t;
+//协程的栈从所属runtime的UThreadStackPool中获取
+typedef std::function<UThreadContext *(UThreadStackPool *, UThreadFunc_t, void *,
+    UThreadDoneCallback_t)> ContextCreateFunc_t;
 
 class UThreadContext {
 public:
     UThreadContext() { }
     virtual ~UThreadContext() { }
 
-    static UThreadContext *Create(size_t stack_size, UThreadFunc_t func, void *args,
-        UThreadDoneCallback_t callback, const bool need_stack_protect); 
+    static UThreadContext *Create(UThreadStackPool *stack_pool, UThreadFunc_t func, void *args,
+        UThreadDoneCallback_t callback); 
 
     static void SetContextCreateFunc(ContextCreateFunc_t context_create_func);
     static ContextCreateFunc_t GetContextCreateFunc();
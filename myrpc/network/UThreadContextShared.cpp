@@ -0,0 +1,148 @@
+/* 继承了UThreadContext，使用共享栈的协程上下文.
+ * 每个UThreadRuntime有一组共享栈，协程创建时轮流分配其中一个，
+ * 运行时直接使用共享栈，切出后栈上的数据仍然留在共享栈中，
+ * 直到同一个共享栈上的另一个协程要运行时，才把有效的部分拷贝到按大小分配的堆内存中，
+ * 再次运行时拷贝回原来的位置.
+ * 因为协程的栈在切出后会被拷走，不能把协程栈上变量的地址交给其他协程或者内核异步使用.
+ * 上下文切换使用UThreadContextAsm的汇编实现.
+ * */
+
+#include "UThreadContextShared.h"
+#include "UThreadContextAsm.h"
+#include <assert.h>
+#include <cstdlib>
+#include <cstring>
+
+namespace myrpc {
+
+UThreadSharedStackPool::UThreadSharedStackPool(const size_t stack_size, const size_t stack_count,
+    const bool need_protect) {
+    for (size_t i = 0; i < stack_count; i++)
+        stack_list_.emplace_back(new UThreadSharedStack(stack_size, need_protect));
+}
+
+UThreadSharedStackPool::~UThreadSharedStackPool() {
+
+}
+
+//轮流分配共享栈
+UThreadSharedStack *UThreadSharedStackPool::Next() {
+    UThreadSharedStack *stack = stack_list_[next_].get();
+    next_ = (next_ + 1) % stack_list_.size();
+    return stack;
+}
+
+size_t UThreadSharedStackPool::GetSavedBytes() const {
+    return saved_bytes_;
+}
+
+void UThreadSharedStackPool::AddSavedBytes(const long bytes) {
+    saved_bytes_ += bytes;
+}
+
+UThreadContextShared::UThreadContextShared(UThreadSharedStackPool *pool, UThreadFunc_t func, void *args,
+    UThreadDoneCallback_t callback)
+    : context_(nullptr), func_(func), args_(args), callback_(callback), pool_(pool), stack_(pool->Next()),
+      started_(false), save_buffer_(nullptr), save_size_(0), save_capacity_(0) {
+        Make(func, args);
+}
+
+UThreadContextShared::~UThreadContextShared() {
+    if (stack_->occupant == this)
+        stack_->occupant = nullptr;
+    FreeSaveBuffer();
+}
+
+//创建一个协程上下文，栈帧在第一次Resume时才构造，
+//因为此时共享栈上可能还有其他协程的数据
+void UThreadContextShared::Make(UThreadFunc_t func, void *args) {
+    func_ = func;
+    args_ = args;
+    if (stack_->occupant == this)
+        stack_->occupant = nullptr;
+    FreeSaveBuffer();
+    started_ = false;
+}
+
+//切换到一个协程，共享栈被其他协程占用时先把它的数据拷出
+bool UThreadContextShared::Resume() {
+    if (stack_->occupant != this) {
+        if (stack_->occupant != nullptr)
+            stack_->occupant->SaveStack();
+
+        if (started_) {
+            RestoreStack();
+        }
+        else {
+            context_ = UThreadContextAsm::MakeFrame(StackEnd(), UThreadContextShared::UThreadFuncWrapper, this);
+            started_ = true;
+        }
+
+        stack_->occupant = this;
+    }
+
+    UThreadContextAsm::Swap(GetMainContext(), context_);
+    return true;
+}
+
+//切出当前协程，栈上的数据等到需要时再拷出
+bool UThreadContextShared::Yield() {
+    UThreadContextAsm::Swap(&context_, *GetMainContext());
+    return true;
+}
+
+void **UThreadContextShared::GetMainContext() {
+    //每个线程一个的main_context，每次调用Yield()会切换到该协程
+    static __thread void *main_context;
+    return &main_context;
+}
+
+char *UThreadContextShared::StackEnd() {
+    return (char *) stack_->memory.top() + stack_->memory.size();
+}
+
+//把栈上的有效数据拷贝到save_buffer_中，缓冲区过大或过小时重新按大小分配
+void UThreadContextShared::SaveStack() {
+    size_t size = StackEnd() - (char *) context_;
+    if (size > save_capacity_ || size < save_capacity_ / 2) {
+        FreeSaveBuffer();
+        save_buffer_ = (char *) malloc(size);
+        assert(save_buffer_ != nullptr);
+        save_capacity_ = size;
+    }
+
+    memcpy(save_buffer_, context_, size);
+    pool_->AddSavedBytes((long) size - (long) save_size_);
+    save_size_ = size;
+}
+
+//把save_buffer_中的数据拷贝回共享栈，栈指针不变
+void UThreadContextShared::RestoreStack() {
+    memcpy(context_, save_buffer_, save_size_);
+}
+
+void UThreadContextShared::FreeSaveBuffer() {
+    if (save_buffer_ != nullptr)
+        free(save_buffer_);
+    pool_->AddSavedBytes(-(long) save_size_);
+    save_buffer_ = nullptr;
+    save_size_ = 0;
+    save_capacity_ = 0;
+}
+
+//包装了协程的执行函数，协程运行时会切换到这个函数.
+//执行完后释放拷贝缓冲区并让出共享栈，之后只有重新Make才会再次运行
+void UThreadContextShared::UThreadFuncWrapper(void *ptr) {
+    UThreadContextShared *uc = (UThreadContextShared *) ptr;
+    uc->func_(uc->args_);
+    if (uc->callback_ != nullptr) {
+        uc->callback_();
+    }
+
+    uc->FreeSaveBuffer();
+    uc->stack_->occupant = nullptr;
+    UThreadContextAsm::Swap(&uc->context_, *uc->GetMainContext());
+    abort();
+}
+
+}
@@ -0,0 +1,91 @@
+/* 继承了UThreadContext，使用共享栈的协程上下文.
+ * 每个UThreadRuntime有一组共享栈，协程创建时轮流分配其中一个，
+ * 运行时直接使用共享栈，切出后栈上的数据仍然留在共享栈中，
+ * 直到同一个共享栈上的另一个协程要运行时，才把有效的部分拷贝到按大小分配的堆内存中，
+ * 再次运行时拷贝回原来的位置.
+ * 因为协程的栈在切出后会被拷走，不能把协程栈上变量的地址交给其他协程或者内核异步使用.
+ * 上下文切换使用UThreadContextAsm的汇编实现.
+ * */
+
+#pragma once
+
+#include "UThreadContextBase.h"
+#include "UThreadContextUtil.h"
+#include <memory>
+#include <vector>
+
+namespace myrpc {
+
+class UThreadContextShared;
+
+//一个共享栈，occupant为数据还留在栈上的协程
+struct UThreadSharedStack {
+    UThreadSharedStack(const size_t stack_size, const bool need_protect)
+        : memory(stack_size, need_protect), occupant(nullptr) { }
+
+    UThreadStackMemory memory;
+    UThreadContextShared *occupant;
+};
+
+//每个UThreadRuntime一个的共享栈池
+class UThreadSharedStackPool {
+public:
+    UThreadSharedStackPool(const size_t stack_size, const size_t stack_count, const bool need_protect);
+    ~UThreadSharedStackPool();
+
+    //轮流分配共享栈
+    UThreadSharedStack *Next();
+
+    //切出的协程拷贝出来的栈数据的总大小
+    size_t GetSavedBytes() const;
+    void AddSavedBytes(const long bytes);
+
+private:
+    std::vector<std::unique_ptr<UThreadSharedStack>> stack_list_;
+    size_t next_{0};
+    size_t saved_bytes_{0};
+};
+
+class UThreadContextShared : public UThreadContext {
+public:
+    UThreadContextShared(UThreadSharedStackPool *pool, UThreadFunc_t func, void *args,
+        UThreadDoneCallback_t callback);
+    ~UThreadContextShared();
+
+    //创建一个协程上下文，栈帧在第一次Resume时才构造
+    void Make(UThreadFunc_t func, void *args) override;
+    //切换到一个协程，共享栈被其他协程占用时先把它的数据拷出
+    bool Resume() override;
+    //切出当前协程
+    bool Yield() override;
+
+    void **GetMainContext();
+
+private:
+    //包装了协程的执行函数，协程运行时会切换到这个函数
+    static void UThreadFuncWrapper(void *ptr);
+
+    //把栈上的有效数据拷贝到save_buffer_中
+    void SaveStack();
+    //把save_buffer_中的数据拷贝回共享栈
+    void RestoreStack();
+    void FreeSaveBuffer();
+
+    char *StackEnd();
+
+    //切出时保存的栈指针
+    void *context_;
+    UThreadFunc_t func_;
+    void *args_;
+    UThreadDoneCallback_t callback_;
+    UThreadSharedStackPool *pool_;
+    UThreadSharedStack *stack_;
+    //是否已经在共享栈上构造了栈帧
+    bool started_;
+
+    char *save_buffer_;
+    size_t save_size_;
+    size_t save_capacity_;
+};
+
+}
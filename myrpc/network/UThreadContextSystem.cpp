@@ -6,37 +6,45 @@
 
 namespace myrpc {
 
-UThreadContextSystem::UThreadContextSystem(size_t stack_size, UThreadFunc_t func, void *args, 
-    UThreadDoneCallback_t callback, const bool need_stack_protect) 
-    : func_(func),  args_(args), stack_(stack_size, need_stack_protect), callback_(callback) {
+UThreadContextSystem::UThreadContextSystem(UThreadStackPool *stack_pool, UThreadFunc_t func, void *args, 
+    UThreadDoneCallback_t callback) 
+    : func_(func),  args_(args), stack_pool_(stack_pool), stack_(nullptr), callback_(callback), done_(false) {
         Make(func, args);
 }
 
 UThreadContextSystem::~UThreadContextSystem() {
-
+    if (stack_ != nullptr)
+        stack_pool_->Release(stack_);
 }
 
-UThreadContext *UThreadContextSystem::DoCreate(size_t stack_size, UThreadFunc_t func, void *args,
-    UThreadDoneCallback_t callback, const bool need_stack_protect) {
-        return new UThreadContextSystem(stack_size, func, args, callback, need_stack_protect);
+UThreadContext *UThreadContextSystem::DoCreate(UThreadStackPool *stack_pool, UThreadFunc_t func, void *args,
+    UThreadDoneCallback_t callback) {
+        return new UThreadContextSystem(stack_pool, func, args, callback);
 }
 
-//创建一个协程上下文
+//创建一个协程上下文，没有栈时从栈池中获取
 void UThreadContextSystem::Make(UThreadFunc_t func, void *args) {
     func_ = func;
     args_ = args;
+    done_ = false;
+    if (stack_ == nullptr)
+        stack_ = stack_pool_->Acquire();
     getcontext(&context_);
-    context_.uc_stack.ss_sp = stack_.top();
-    context_.uc_stack.ss_size = stack_.size();
+    context_.uc_stack.ss_sp = stack_->top();
+    context_.uc_stack.ss_size = stack_->size();
     context_.uc_stack.ss_flags = 0;
     context_.uc_link = GetMainContext();
     uintptr_t ptr = (uintptr_t) this;
     makecontext(&context_, (void (*)(void))UThreadContextSystem::UThreadFuncWrapper, 2, (uint32_t)ptr, (uint32_t)(ptr >> 32));
 }
 
-//切换到一个协程
+//切换到一个协程，协程执行完后已经不在它的栈上运行，可以把栈放回栈池
 bool UThreadContextSystem::Resume() {
     swapcontext(GetMainContext(), &context_);
+    if (done_) {
+        stack_pool_->Release(stack_);
+        stack_ = nullptr;
+    }
     return true;
 }
 
@@ -60,6 +68,7 @@ void UThreadContextSystem::UThreadFuncWrapper(uint32_t low32, uint32_t high32) {
     if (uc->callback_ != nullptr) {
         uc->callback_();
     }
+    uc->done_ = true;
 }
 
 }
\ No newline at end of file
@@ -11,16 +11,16 @@ namespace myrpc {
 
 class UThreadContextSystem : public UThreadContext {
 public:
-    UThreadContextSystem(size_t stack_size, UThreadFunc_t func, void *args, 
-        UThreadDoneCallback_t callback, const bool need_stack_protect);
+    UThreadContextSystem(UThreadStackPool *stack_pool, UThreadFunc_t func, void *args,
+        UThreadDoneCallback_t callback);
     ~UThreadContextSystem();
 
-    static UThreadContext *DoCreate(size_t stack_size, UThreadFunc_t func, void *args,
-        UThreadDoneCallback_t callback, const bool need_stack_protect);
+    static UThreadContext *DoCreate(UThreadStackPool *stack_pool, UThreadFunc_t func, void *args,
+        UThreadDoneCallback_t callback);
     
-    //创建一个协程上下文
+    //创建一个协程上下文，没有栈时从栈池中获取
     void Make(UThreadFunc_t func, void *args) override; 
-    //切换到一个协程
+    //切换到一个协程，协程执行完后把栈放回栈池
     bool Resume() override;
     //切出当前协程
     bool Yield() override;
@@ -34,8 +34,11 @@ private:
     ucontext_t context_;
     UThreadFunc_t func_;
     void *args_;
-    UThreadStackMemory stack_;
+    UThreadStackPool *stack_pool_;
+    UThreadStackMemory *stack_;
     UThreadDoneCallback_t callback_;
+    //协程函数是否已经执行完
+    bool done_;
 };
 
 }
\ No newline at end of file
@@ -3,12 +3,15 @@
  * 设置标志变量来选择是否开启保护模式.
  * 调用mmap时设置内存段为匿名的，不需要读写fd，
  * 并且为私有映射，不与其他进程共享. 
+ * UThreadStackPool在协程之间回收复用栈，保护页在复用时保持不变，
+ * 空闲的栈超过high_water后用madvise释放其中的脏页，超过max_free后用munmap释放整个栈.
  * */
 
 #include "UThreadContextUtil.h"
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <vector>
 
 namespace myrpc {
 
@@ -30,7 +33,7 @@ UThreadStackMemory::UThreadStackMemory(const size_t stack_size, const bool need_
         raw_stack_ = mmap(NULL, stack_size_ + page_size * 2, PROT_READ | PROT_WRITE,
         MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
 
-        assert (raw_stack_ != nullptr);
+        assert(raw_stack_ != MAP_FAILED);
 
         //设置为禁止访问
         mprotect(raw_stack_, page_size, PROT_NONE);
@@ -40,7 +43,7 @@ UThreadStackMemory::UThreadStackMemory(const size_t stack_size, const bool need_
     }
     else {
         raw_stack_ = mmap(NULL, stack_size_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-        assert(raw_stack_ != nullptr);
+        assert(raw_stack_ != MAP_FAILED);
         stack_ = raw_stack_;
     }
 }
@@ -64,4 +67,94 @@ size_t UThreadStackMemory::size() {
     return stack_size_;
 }
 
-}
\ No newline at end of file
+UThreadStackPool::UThreadStackPool(const size_t stack_size, const bool need_protect, const size_t max_free,
+    const size_t high_water)
+    : stack_size_(stack_size), need_protect_(need_protect), max_free_(max_free), high_water_(high_water) {
+
+}
+
+UThreadStackPool::~UThreadStackPool() {
+
+}
+
+void UThreadStackPool::SetMaxFree(const size_t max_free) {
+    max_free_ = max_free;
+    while (free_list_.size() > max_free_)
+        UnmapOldest();
+}
+
+size_t UThreadStackPool::GetMaxFree() const {
+    return max_free_;
+}
+
+//优先取出最近放回的栈，没有空闲的栈时才调用mmap
+UThreadStackMemory *UThreadStackPool::Acquire() {
+    if (!free_list_.empty()) {
+        UThreadStackMemory *stack = free_list_.back();
+        free_list_.pop_back();
+        if (clean_count_ > free_list_.size())
+            clean_count_ = free_list_.size();
+        return stack;
+    }
+
+    UThreadStackMemory *stack = new UThreadStackMemory(stack_size_, need_protect_);
+    stack_map_[stack].reset(stack);
+    return stack;
+}
+
+//放回的栈放在尾部，最先被复用.
+//空闲的栈超过max_free_时，munmap最早放回的一个；
+//没有释放过脏页的空闲栈过多时，释放其中最早放回的一个的脏页，它在free_list_中的位置不变
+void UThreadStackPool::Release(UThreadStackMemory *stack) {
+    free_list_.push_back(stack);
+
+    if (free_list_.size() > max_free_) {
+        UnmapOldest();
+        return;
+    }
+
+    if (free_list_.size() - clean_count_ > high_water_) {
+        UThreadStackMemory *oldest = free_list_[clean_count_];
+        madvise(oldest->top(), oldest->size(), MADV_DONTNEED);
+        clean_count_++;
+    }
+}
+
+//头部的栈最早放回，如果已经释放过脏页也在头部
+void UThreadStackPool::UnmapOldest() {
+    UThreadStackMemory *oldest = free_list_.front();
+    free_list_.pop_front();
+    if (clean_count_ > 0)
+        clean_count_--;
+    stack_map_.erase(oldest);
+}
+
+size_t UThreadStackPool::GetPooledBytes() const {
+    if (stack_map_.empty())
+        return 0;
+    return free_list_.size() * stack_map_.begin()->second->size();
+}
+
+size_t UThreadStackPool::GetActiveBytes() const {
+    if (stack_map_.empty())
+        return 0;
+    return (stack_map_.size() - free_list_.size()) * stack_map_.begin()->second->size();
+}
+
+size_t UThreadStackPool::GetResidentBytes() const {
+    size_t page_size = getpagesize();
+    size_t resident_pages = 0;
+    std::vector<unsigned char> vec;
+    for (auto &item : stack_map_) {
+        UThreadStackMemory *stack = item.second.get();
+        vec.resize(stack->size() / page_size);
+        if (mincore(stack->top(), stack->size(), vec.data()) != 0)
+            continue;
+        for (auto page : vec)
+            resident_pages += page & 1;
+    }
+
+    return resident_pages * page_size;
+}
+
+}
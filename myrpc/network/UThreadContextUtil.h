@@ -3,11 +3,15 @@
  * 设置标志变量来选择是否开启保护模式.
  * 调用mmap时设置内存段为匿名的，不需要读写fd，
  * 并且为私有映射，不与其他进程共享. 
+ * UThreadStackPool在协程之间回收复用栈，保护页在复用时保持不变，
+ * 空闲的栈超过high_water后用madvise释放其中的脏页，超过max_free后用munmap释放整个栈.
  * */
 
 #pragma once 
 
 #include <memory>
+#include <unordered_map>
+#include <deque>
 #include <sys/mman.h>
 
 namespace myrpc {
@@ -31,4 +35,44 @@ private:
     int need_protect_;
 };
 
-}
\ No newline at end of file
+//每个UThreadRuntime一个的栈池
+class UThreadStackPool {
+public:
+    //没有释放过脏页的空闲栈超过high_water个后，释放其中最早放回的栈的脏页，
+    //空闲的栈超过max_free个后，munmap最早放回的栈，连同保护页的映射一起释放
+    UThreadStackPool(const size_t stack_size, const bool need_protect, const size_t max_free = 1024,
+        const size_t high_water = 256);
+    ~UThreadStackPool();
+
+    //调小时立即释放多出的空闲栈
+    void SetMaxFree(const size_t max_free);
+    size_t GetMaxFree() const;
+
+    //优先取出最近放回的栈
+    UThreadStackMemory *Acquire();
+    void Release(UThreadStackMemory *stack);
+
+    //空闲的栈的总大小
+    size_t GetPooledBytes() const;
+    //正在被协程使用的栈的总大小
+    size_t GetActiveBytes() const;
+    //所有栈实际驻留在内存中的大小，使用mincore统计
+    size_t GetResidentBytes() const;
+
+private:
+    //munmap最早放回的空闲栈
+    void UnmapOldest();
+
+    size_t stack_size_;
+    bool need_protect_;
+    size_t max_free_;
+    size_t high_water_;
+
+    //所有已经映射的栈，包括空闲的和正在使用的
+    std::unordered_map<UThreadStackMemory *, std::unique_ptr<UThreadStackMemory>> stack_map_;
+    //尾部为最近放回的栈，头部的clean_count_个栈已经释放过脏页
+    std::deque<UThreadStackMemory *> free_list_;
+    size_t clean_count_{0};
+};
+
+}
@@ -4,7 +4,12 @@
 
 #include "UThreadEpoll.h"
 #include "SocketStreamBase.h"
+#include "TimingWheel.h"
+#include "UThreadUring.h"
+#include "UThreadSync.h"
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string>
@@ -29,6 +34,15 @@ typedef struct tagUThreadSocket {
     int socket_timeout_ms;
 
     int waited_events;
+    //当前协程正在等待的事件，为0时表示没有协程在等待该socket上的IO
+    int poll_events;
+    //边缘触发下缓存的就绪状态，在IO操作返回EAGAIN时清除对应的位
+    int ready_events;
+    //是否已经在epoll中注册，注册后在socket的整个生命周期内保持不变
+    bool epoll_registered;
+    //是否有提交到io_uring的操作还没有完成，以及该操作的结果
+    bool uring_pending;
+    int uring_res;
     //保存该socket的定时器在heap数组中的位置，如果存在，方便进行查找
     size_t timer_id;
     struct epoll_event event;
@@ -37,72 +51,94 @@ typedef struct tagUThreadSocket {
 
 EpollNotifier::EpollNotifier(UThreadEpollScheduler *scheduler)
     : scheduler_(scheduler) {
-        pipe_fds_[0] = pipe_fds_[1] = -1;
+    //在构造时就创建eventfd，调度器开始运行之前其他线程也可以调用Notify
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(event_fd_ >= 0);
 }
 
 EpollNotifier::~EpollNotifier() {
-    if (pipe_fds_[0] != -1) 
-        close(pipe_fds_[0]);
-    if (pipe_fds_[1] != - 1)
-        close(pipe_fds_[1]);
+    if (event_fd_ != -1) 
+        close(event_fd_);
 }
 
-//将Func函数加入调度器任务队列
-void EpollNotifier::Run() {
-    //创建管道
-    pipe(pipe_fds_);
-    //assert
-    fcntl(pipe_fds_[1], F_SETFL, O_NONBLOCK);
-    scheduler_->AddTask(std::bind(&EpollNotifier::Func, this), nullptr);    
+int EpollNotifier::fd() const {
+    return event_fd_;
 }
 
-//读取管道，唤醒epoll
-void EpollNotifier::Func() {
-    UThreadSocket_t *socket{scheduler_->CreateSocket(pipe_fds_[0], -1, -1, false)};
-    char tmp[2] = {0};
-    while (true) {
-        if (UThreadRead(*socket, tmp, 1, 0) < 0) 
-            break;
+//读空eventfd，由调度器在处理轮询工作之前调用
+void EpollNotifier::Consume() {
+    uint64_t count{0};
+    if (read(event_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        //log
     }
-    free(socket);
+
+    //先读空eventfd再清除标志. 清除之前到达的Notify没有写eventfd，
+    //但它们提交的数据会在本轮循环接下来的轮询中被处理；清除之后到达的Notify会重新写eventfd
+    signalled_.store(false);
 }
 
+/* 先设置notified_再检查sleeping_，和PrepareSleep中相反的顺序配对，两边至少有一边能看到对方：
+ * 调度器看到notified_时不阻塞，Notify看到sleeping_时写eventfd.
+ * 调度器在运行时，提交的数据会在本轮或者下一轮循环的轮询中被处理，不需要系统调用 */
 void EpollNotifier::Notify() {
-    ssize_t write_len = write(pipe_fds_[1], (void *)"a", 1);
+    notified_.store(true);
+    if (!sleeping_.load())
+        return;
+
+    //已经写入过eventfd且调度器还没有读取，不需要再次写入
+    if (signalled_.exchange(true))
+        return;
+
+    uint64_t count{1};
+    ssize_t write_len = write(event_fd_, &count, sizeof(count));
     if (write_len < 0) {
         //log
     }
 }
 
+bool EpollNotifier::PrepareSleep() {
+    sleeping_.store(true);
+    if (notified_.load()) {
+        sleeping_.store(false);
+        return false;
+    }
+
+    return true;
+}
+
+//先清除sleeping_，之后的Notify不再写eventfd；
+//再清除notified_，之后的Notify会让下一次PrepareSleep返回false
+void EpollNotifier::FinishSleep() {
+    sleeping_.store(false);
+    notified_.store(false);
+}
 
 UThreadNotifier::UThreadNotifier() {
-    pipe_fds_[0] = pipe_fds_[1] = -1;
+
 }
 
 UThreadNotifier::~UThreadNotifier() {
     free(socket_);
-    if (pipe_fds_[0] != -1) 
-        close(pipe_fds_[0]);
-    if (pipe_fds_[1] != -1)
-        close(pipe_fds_[1]);
+    if (event_fd_ != -1) 
+        close(event_fd_);
 }
 
 int UThreadNotifier::Init(UThreadEpollScheduler *const scheduler,
         const int timeout_ms) {
-    int ret {pipe(pipe_fds_)};
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
-    if (ret != 0)
-        return ret;
+    if (event_fd_ < 0)
+        return -1;
 
-    fcntl(pipe_fds_[1], F_SETFL, O_NONBLOCK);
-    socket_ = scheduler->CreateSocket(pipe_fds_[0], timeout_ms, -1, false);
+    socket_ = scheduler->CreateSocket(event_fd_, timeout_ms, -1, false);
 
     return 0;
 }
 
 int UThreadNotifier::SendNotify(void *const data) {
     data_ = data;
-    ssize_t write_len {write(pipe_fds_[1], (void *) "a", 1)};
+    uint64_t count{1};
+    ssize_t write_len {write(event_fd_, &count, sizeof(count))};
 
     if (write_len < 0) {
         //log
@@ -113,8 +149,8 @@ int UThreadNotifier::SendNotify(void *const data) {
 }
 
 int UThreadNotifier::WaitNotify(void *&data) {
-    char buf;
-    ssize_t read_len{UThreadRead(*socket_, (void *) &buf, 1, 0)};
+    uint64_t count{0};
+    ssize_t read_len{UThreadRead(*socket_, &count, sizeof(count), 0)};
 
     if (read_len < 0) {
         //log
@@ -172,10 +208,16 @@ enum UThreadEpollREventStatus {
 };
 
 UThreadEpollScheduler::UThreadEpollScheduler(size_t stack_size, int max_task, 
-    const bool need_stack_protect) 
-    : runtime_(stack_size, need_stack_protect), epoll_wake_up_(this) {
+    const bool need_stack_protect, const TimerType timer_type, const IOBackend io_backend,
+    const size_t shared_stack_count) 
+    : runtime_(stack_size, need_stack_protect, shared_stack_count, max_task), epoll_wake_up_(this) {
     max_task_ = max_task + 1;
 
+    if (timer_type == TimerType::WHEEL)
+        timer_.reset(new TimingWheel);
+    else
+        timer_.reset(new Timer);
+
     epoll_fd_ = epoll_create(max_task_);
 
     if (epoll_fd_ < 0) {
@@ -183,11 +225,37 @@ UThreadEpollScheduler::UThreadEpollScheduler(size_t stack_size, int max_task,
         assert(epoll_fd_ >= 0);
     }
 
+    //eventfd以水平触发的方式注册，data.ptr指向epoll_wake_up_，没有读空之前会一直唤醒epoll_wait
+    struct epoll_event wake_up_event;
+    wake_up_event.events = EPOLLIN;
+    wake_up_event.data.ptr = &epoll_wake_up_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, epoll_wake_up_.fd(), &wake_up_event) != 0) {
+        //log
+        assert(false);
+    }
+
+    //io_uring的fd注册到epoll中，data.ptr为nullptr，有完成事件时唤醒epoll_wait.
+    //共享栈模式下协程切出后栈会被拷走，栈上的缓冲区不能交给内核异步读写
+    if (io_backend == IOBackend::URING && shared_stack_count == 0) {
+        uring_.reset(new UThreadUring);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        if (!uring_->Init(max_task_ < 4096 ? 4096 : 32768) || 
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, uring_->fd(), &event) != 0) {
+            //log
+            uring_.reset();
+        }
+    }
+
     closed_ = false;
     run_forever_ = false;
     active_socket_func_ = nullptr;
     handler_accepted_fd_func_ = nullptr;
     handler_new_request_func_ = nullptr;
+    has_pending_work_func_ = nullptr;
+    sleep_func_ = nullptr;
+    second_func_ = nullptr;
 
     epoll_wait_events_ = 0;
     epoll_wait_events_per_second_ = 0;
@@ -195,6 +263,7 @@ UThreadEpollScheduler::UThreadEpollScheduler(size_t stack_size, int max_task,
 }
 
 UThreadEpollScheduler::~UThreadEpollScheduler() {
+    uring_.reset();
     close(epoll_fd_);
 }
 
@@ -203,8 +272,19 @@ UThreadEpollScheduler *UThreadEpollScheduler::Instance() {
     return &obj;
 }
 
+//在Run中设置，同步原语用它找到当前协程所属的调度器
+static __thread UThreadEpollScheduler *current_scheduler = nullptr;
+
+UThreadEpollScheduler *UThreadEpollScheduler::GetCurrentScheduler() {
+    return current_scheduler;
+}
+
 bool UThreadEpollScheduler::IsTaskFull() {
-    return (runtime_.GetUnfinishedItemCount() + (int)todo_list_.size()) >= max_task_;
+    return GetFreeTaskCount() <= 0;
+}
+
+int UThreadEpollScheduler::GetFreeTaskCount() {
+    return max_task_ - (runtime_.GetUnfinishedItemCount() + (int)todo_list_.size());
 }
 
 //将任务添加到todo_list_中
@@ -220,6 +300,22 @@ void UThreadEpollScheduler::SetHandlerNewRequestFunc(UThreadHandlerNewRequest_t
     handler_new_request_func_ = handler_new_request_func;
 }
 
+void UThreadEpollScheduler::SetHasPendingWorkFunc(UThreadHasPendingWork_t has_pending_work_func) {
+    has_pending_work_func_ = has_pending_work_func;
+}
+
+void UThreadEpollScheduler::SetSleepFunc(UThreadSleep_t sleep_func) {
+    sleep_func_ = sleep_func;
+}
+
+void UThreadEpollScheduler::SetSecondFunc(UThreadSecond_t second_func) {
+    second_func_ = second_func;
+}
+
+void UThreadEpollScheduler::SetBusyPollUS(const int busy_poll_us) {
+    busy_poll_us_ = busy_poll_us;
+}
+
 void UThreadEpollScheduler::SetHandlerAcceptedFdFunc(UThreadHandlerAcceptedFdFunc_t handler_accepted_fd_func) {
     handler_accepted_fd_func_ = handler_accepted_fd_func;
 }
@@ -228,10 +324,46 @@ bool UThreadEpollScheduler::YieldTask() {
     return  runtime_.Yield();
 }
 
+//借用同步原语的唤醒列表，在DealwithWakeUp中被Resume.
+//在DealwithWakeUp中再次调用时会留到下一次循环，此时epoll_wait不会阻塞
+void UThreadEpollScheduler::DeferTask() {
+    UThreadWaiter *waiter = UThreadWaitQueue::CreateWaiter();
+    WakeUp(waiter);
+    UThreadWaitQueue::Wait(waiter);
+}
+
 int UThreadEpollScheduler::GetCurrUThread() {
     return runtime_.GetCurrUThread();
 }
 
+const UThreadStackPool &UThreadEpollScheduler::GetStackPool() const {
+    return runtime_.GetStackPool();
+}
+
+void UThreadEpollScheduler::SetMaxFreeStackCount(const size_t max_free_stack_count) {
+    runtime_.SetMaxFreeStackCount(max_free_stack_count);
+}
+
+size_t UThreadEpollScheduler::GetSharedStackSavedBytes() const {
+    return runtime_.GetSharedStackSavedBytes();
+}
+
+UThreadUring *UThreadEpollScheduler::GetUring() {
+    return uring_.get();
+}
+
+int UThreadEpollScheduler::GetLoopWakeupsPerSecond() const {
+    return loop_wakeups_per_second_;
+}
+
+int UThreadEpollScheduler::GetTimerLatenessMaxUS() const {
+    return timer_lateness_max_us_per_second_;
+}
+
+int UThreadEpollScheduler::GetTimerLatenessAvgUS() const {
+    return timer_lateness_avg_us_per_second_;
+}
+
 UThreadSocket_t *UThreadEpollScheduler::CreateSocket(const int fd, 
     const int socket_timeout_ms, const int connect_timeout_ms, const bool no_delay) {
     UThreadSocket_t  *socket = (UThreadSocket_t *) calloc (1, sizeof(UThreadSocket_t));
@@ -249,6 +381,11 @@ UThreadSocket_t *UThreadEpollScheduler::CreateSocket(const int fd,
     socket->socket_timeout_ms = socket_timeout_ms;
 
     socket->waited_events = 0;
+    socket->poll_events = 0;
+    socket->ready_events = 0;
+    socket->epoll_registered = false;
+    socket->uring_pending = false;
+    socket->uring_res = 0;
     socket->args = nullptr;
 
     return socket;
@@ -271,63 +408,136 @@ void UThreadEpollScheduler::Close() {
 }
 
 void UThreadEpollScheduler::NotifyEpoll() {
-    if (epoll_wait_events_per_second_ < 2000) {
-        //log
-        epoll_wake_up_.Notify();
-    }
+    epoll_wake_up_.Notify();
 }
 
 void UThreadEpollScheduler::ResumeAll(int flag) {
-    std::vector<UThreadSocket_t *> exist_socket_list = timer_.GetSocketList();
+    std::vector<UThreadSocket_t *> exist_socket_list = timer_->GetSocketList();
     for (auto &socket : exist_socket_list) {
         socket->waited_events = flag;
         runtime_.Resume(socket->uthread_id);
     }
 }
 
-/* 首先调用EpollNotifier的Run函数，将Func函数加入调度器的任务队列，Func函数会读取管道，唤醒epoll.
- * 下一步会将任务队列中的函数创建为协程，并Resume切换到协程，协程中会将fd的相应操作在epoll中注册，
- * 然后Yield回到回到Run. Run函数检查活动的fd，并Resume到活动的协程中进行IO操作。 */
+//和Run相同，但所有协程都结束后也不退出，直到调用Close
 void UThreadEpollScheduler::RunForever() {
     run_forever_ = true;
-    epoll_wake_up_.Run();
     Run();
 }
 
+//每秒统计一次epoll_wait的事件数、事件循环的唤醒次数和定时器的延迟
 void UThreadEpollScheduler::StatEpollwaitEvents(const int event_count) {
     epoll_wait_events_ += event_count;
+    loop_wakeups_++;
     auto now_time = Timer::GetSteadyClockMS();
     if (now_time > epoll_wait_events_last_cal_time_ + 1000) {
         epoll_wait_events_per_second_ = epoll_wait_events_;
+        loop_wakeups_per_second_ = loop_wakeups_;
+        timer_lateness_max_us_per_second_ = timer_lateness_max_us_;
+        timer_lateness_avg_us_per_second_ = timer_lateness_count_ > 0 ? 
+            (int) (timer_lateness_sum_us_ / timer_lateness_count_) : 0;
+
         epoll_wait_events_ = 0;
+        loop_wakeups_ = 0;
+        timer_lateness_sum_us_ = 0;
+        timer_lateness_count_ = 0;
+        timer_lateness_max_us_ = 0;
         epoll_wait_events_last_cal_time_ = now_time;
         //log
     }
 }
 
+/* 有不需要等待事件就能处理的工作时不阻塞，否则一直阻塞到下一个定时器到期，
+ * 期间的IO事件、io_uring完成事件和NotifyEpoll都会唤醒epoll_wait.
+ * 开启忙轮询时，最近一次有事件之后的busy_poll_us_微秒内也不阻塞 */
+int UThreadEpollScheduler::GetEpollTimeout(const int next_timeout) {
+    if (next_timeout == 0 || !todo_list_.empty() || has_wakeup_)
+        return 0;
+
+    //例如worker的协程数已满时留在队列中的请求，协程结束后需要马上处理
+    if (has_pending_work_func_ != nullptr && has_pending_work_func_())
+        return 0;
+
+    if (busy_poll_us_ > 0 && Timer::GetSteadyClockUS() < last_active_us_ + busy_poll_us_)
+        return 0;
+
+    return next_timeout;
+}
+
 /* Run函数先会将任务队列中的函数创建为协程，并Resume切换到协程，协程中会将fd的相应操作在epoll中注册，
  * 然后Yield回到回到Run. Run函数检查活动的fd，并Resume到活动的协程中进行IO操作. */
 bool UThreadEpollScheduler::Run() {
+    UThreadEpollScheduler *prev_scheduler = current_scheduler;
+    current_scheduler = this;
+
     //将任务队列中的函数创建为协程
     ConsumeTodoList();
 
     struct epoll_event *events = (struct epoll_event *) calloc (max_task_, sizeof(struct epoll_event));
 
-    int next_timeout = timer_.GetNextTimeout();
+    int next_timeout = timer_->GetNextTimeout();
+    next_deadline_ms_ = next_timeout > 0 ? Timer::GetSteadyClockMS() + next_timeout : 0;
 
     for ( ; (run_forever_) || (!runtime_.IsAllDone()); ) {
-        /* 监听fd上的活动事件 ，并把超时事件设置为4 ms.
-         * 如果超时，则轮询的处理工作. */
-        int nfds = epoll_wait(epoll_fd_, events, max_task_, 4);
+        /* 监听fd上的活动事件，没有需要马上处理的工作时一直阻塞到下一个定时器到期或者被唤醒.
+         * 返回后处理轮询的工作. */
+        //一次循环中积累的io_uring操作在这里统一提交
+        if (uring_ != nullptr)
+            uring_->Submit();
+
+        //要阻塞时先告诉NotifyEpoll需要写eventfd，调度器运行时的通知不需要系统调用
+        int epoll_timeout = GetEpollTimeout(next_timeout);
+        if (epoll_timeout != 0 && !epoll_wake_up_.PrepareSleep())
+            epoll_timeout = 0;
+
+        bool sleeping = epoll_timeout != 0 && sleep_func_ != nullptr;
+        if (sleeping)
+            sleep_func_(true);
+
+        int nfds = epoll_wait(epoll_fd_, events, max_task_, epoll_timeout);
+        epoll_wake_up_.FinishSleep();
+        if (sleeping)
+            sleep_func_(false);
+
+        //阻塞之后先刷新，本次循环处理的事件看到的是当前的时间
+        if (second_func_ != nullptr) {
+            time_t now = time(nullptr);
+            if (now != last_second_) {
+                last_second_ = now;
+                second_func_(now);
+            }
+        }
         if (nfds != -1) {
+            if (busy_poll_us_ > 0 && nfds > 0)
+                last_active_us_ = Timer::GetSteadyClockUS();
+
             //处理socket上的活动事件
             for (int i = 0; i < nfds; i++) {
                 UThreadSocket_t *socket = (UThreadSocket_t *) events[i].data.ptr;
-                socket->waited_events = events[i].events;
-
-                runtime_.Resume(socket->uthread_id);
+                //io_uring的fd，完成事件在下面统一处理
+                if (socket == nullptr)
+                    continue;
+
+                //NotifyEpoll写入的eventfd，被通知的工作在下面的轮询中处理
+                if ((void *) socket == (void *) &epoll_wake_up_) {
+                    epoll_wake_up_.Consume();
+                    continue;
+                }
+
+                socket->ready_events |= events[i].events;
+
+                //socket是持久注册的，只有协程正在等待对应方向的事件时才切换过去，
+                //否则只记录就绪状态，留给下一次IO操作使用
+                if (socket->poll_events != 0 && 
+                    (events[i].events & (socket->poll_events | EPOLLERR | EPOLLHUP))) {
+                    socket->waited_events = events[i].events;
+                    runtime_.Resume(socket->uthread_id);
+                }
             }
 
+            if (uring_ != nullptr)
+                ReapUring();
+
             //轮询工作
             //读取data flow，如果有responce可以读取，通知相应的socket写给client
             if (active_socket_func_ != nullptr) {
@@ -346,11 +556,15 @@ bool UThreadEpollScheduler::Run() {
 
             if (closed_) {
                 ResumeAll(UThreadEpollREvent_Close);
+                //同步原语上的协程不会被唤醒，它们的协程和UThreadWaiter会泄漏
+                assert(sync_waiter_count_ == 0);
                 break;
             }
 
             ConsumeTodoList();
 
+            DealwithWakeUp();
+
             //处理超时事件
             DealwithTimeout(next_timeout);
         }
@@ -358,70 +572,172 @@ bool UThreadEpollScheduler::Run() {
             ResumeAll(UThreadEpollREvent_Error);
             break;
         }
+        else {
+            //被信号打断时重新计算到下一个定时器的时间
+            next_timeout = timer_->GetNextTimeout();
+        }
 
         StatEpollwaitEvents(nfds);
     }
     
     free(events);
 
+    current_scheduler = prev_scheduler;
+
     return true;
 }
 
+//唤醒一个等待在同步原语上的本调度器的协程，在其他线程调用时需要唤醒epoll_wait
+void UThreadEpollScheduler::WakeUp(UThreadWaiter *waiter) {
+    {
+        std::lock_guard<std::mutex> lock(wakeup_mutex_);
+        wakeup_list_.push_back(waiter);
+        has_wakeup_ = true;
+    }
+
+    if (current_scheduler != this)
+        NotifyEpoll();
+}
+
+void UThreadEpollScheduler::AddSyncWaiterCount(const int count) {
+    sync_waiter_count_ += count;
+}
+
+int UThreadEpollScheduler::GetSyncWaiterCount() const {
+    return sync_waiter_count_;
+}
+
+//Resume被同步原语唤醒的协程，waiter在协程中被删除，Resume之后不能再访问
+void UThreadEpollScheduler::DealwithWakeUp() {
+    if (!has_wakeup_)
+        return;
+
+    std::vector<UThreadWaiter *> wakeup_list;
+    {
+        std::lock_guard<std::mutex> lock(wakeup_mutex_);
+        wakeup_list.swap(wakeup_list_);
+        has_wakeup_ = false;
+    }
+
+    for (auto &waiter : wakeup_list) {
+        int uthread_id = waiter->uthread_id;
+        waiter->signalled = true;
+        runtime_.Resume(uthread_id);
+    }
+}
+
+//读取io_uring的完成事件，并Resume到对应的协程
+void UThreadEpollScheduler::ReapUring() {
+    uint64_t user_data{0};
+    int res{0};
+    while (uring_->PopCqe(&user_data, &res)) {
+        //取消请求本身的完成事件
+        if (user_data == 0)
+            continue;
+
+        UThreadSocket_t *socket = (UThreadSocket_t *) user_data;
+        socket->uring_res = res;
+        socket->uring_pending = false;
+        socket->waited_events = EPOLLIN;
+        runtime_.Resume(socket->uthread_id);
+    }
+}
+
 void UThreadEpollScheduler::AddTimer(UThreadSocket_t *socket, const int timeout_ms) {
     RemoveTimer(socket->timer_id);
 
     if (timeout_ms == -1) {
-        timer_.AddTimer((std::numeric_limits<uint64_t>::max)(), socket);
+        timer_->AddTimer((std::numeric_limits<uint64_t>::max)(), socket);
     }
     else {
         //先获得当前的时间，再在该时间上加上timeout_ms
-        timer_.AddTimer(Timer::GetSteadyClockMS() + timeout_ms, socket);
+        timer_->AddTimer(Timer::GetSteadyClockMS() + timeout_ms, socket);
     }
 }
 
 void UThreadEpollScheduler::RemoveTimer(const size_t timer_id) {
     if (timer_id > 0)
-        timer_.RemoveTimer(timer_id);
+        timer_->RemoveTimer(timer_id);
 }
 
-//处理超时事件
+//处理超时事件，并记录下一个定时器的到期时间
 void UThreadEpollScheduler::DealwithTimeout(int &next_timeout) {
+    bool expired{false};
     while (true) {
-        next_timeout = timer_.GetNextTimeout();
+        next_timeout = timer_->GetNextTimeout();
         if (0 != next_timeout) {
             break;
         }
 
-        UThreadSocket_t *socket = timer_.PopTimeout();
+        //第一个到期的定时器的处理时间和上一次计算的到期时间的差就是定时器的延迟
+        if (!expired && next_deadline_ms_ != 0) {
+            uint64_t now_us = Timer::GetSteadyClockUS();
+            int lateness_us = now_us > next_deadline_ms_ * 1000 ? (int) (now_us - next_deadline_ms_ * 1000) : 0;
+            timer_lateness_sum_us_ += lateness_us;
+            timer_lateness_count_++;
+            if (lateness_us > timer_lateness_max_us_)
+                timer_lateness_max_us_ = lateness_us;
+        }
+        expired = true;
+
+        UThreadSocket_t *socket = timer_->PopTimeout();
         socket->waited_events = UThreadEpollREvent_Timeout;
         runtime_.Resume(socket->uthread_id);
     }
+
+    next_deadline_ms_ = next_timeout > 0 ? Timer::GetSteadyClockMS() + next_timeout : 0;
 }
 
 
+//socket第一次等待时以边缘触发的方式在epoll中注册IN和OUT事件，之后一直保持注册
+static int UThreadSocketRegister(UThreadSocket_t &socket) {
+    if (socket.epoll_registered)
+        return 0;
+
+    socket.event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    if (epoll_ctl(socket.epoll_fd, EPOLL_CTL_ADD, socket.socket, &socket.event) != 0) {
+        //log
+        return -1;
+    }
+    socket.epoll_registered = true;
+
+    return 0;
+}
+
 //接受一个socket的版本 
-//epoll_ctl注册对应事件后Yield，Resume回来后删除注册
+//socket第一次等待时以边缘触发的方式在epoll中注册IN和OUT事件，之后一直保持注册，
+//等待时只记录协程等待的方向然后Yield，不再需要epoll_ctl
 int UThreadPoll(UThreadSocket_t &socket, int events, int *revents, const int timeout_ms) {
     int ret{-1};
 
-    //获得当前正在执行的协程
-    socket.uthread_id = socket.scheduler->GetCurrUThread();
+    //缓存中已经有就绪的事件，直接返回，不切出协程
+    int ready_events = socket.ready_events & (events | EPOLLERR | EPOLLHUP);
+    if (ready_events != 0) {
+        socket.waited_events = ready_events;
+    }
+    else {
+        if (UThreadSocketRegister(socket) != 0) {
+            *revents = 0;
+            return -1;
+        }
 
-    //增加超时事件
-    socket.event.events = events;
+        //获得当前正在执行的协程，并记录该协程等待的事件
+        socket.uthread_id = socket.scheduler->GetCurrUThread();
+        socket.poll_events = events;
+        socket.waited_events = UThreadEpollREvent_Timeout;
 
-    socket.scheduler->AddTimer(&socket, timeout_ms);
-    //事件加入epoll中进行调度，为了处理当超时事件还没达到时就触发事件，使得提前结束
-    epoll_ctl(socket.epoll_fd, EPOLL_CTL_ADD, socket.socket, &socket.event);
+        //增加超时事件，为了处理当超时事件还没达到时就触发事件，使得提前结束
+        socket.scheduler->AddTimer(&socket, timeout_ms);
 
-    //将当前的协程停止，转让CPU给主协程
-    //当主协程下一次收到这个超时事件的时候，将执行权还给这个协程
-    //协程从当前位置开始执行
-    socket.scheduler->YieldTask();
+        //将当前的协程停止，转让CPU给主协程
+        //当主协程下一次收到这个socket的事件或超时事件的时候，将执行权还给这个协程
+        //协程从当前位置开始执行
+        socket.scheduler->YieldTask();
 
-    //超时任务完成，协程继续从此处执行，并删除定时器 
-    epoll_ctl(socket.epoll_fd, EPOLL_CTL_DEL, socket.socket, &socket.event);
-    socket.scheduler->RemoveTimer(socket.timer_id);
+        //协程继续从此处执行，清除等待的事件并删除定时器
+        socket.poll_events = 0;
+        socket.scheduler->RemoveTimer(socket.timer_id);
+    }
 
     *revents = socket.waited_events;
 
@@ -449,57 +765,190 @@ int UThreadPoll(UThreadSocket_t &socket, int events, int *revents, const int tim
         ret = -1;
     }
 
-    return -1;
+    return ret;
 }
 
 //接受一组socket的版本 
-int UThreadPoll(UThreadSocket_t *list[], int count, const int timeout_ms) {
-    int nfds = -1;
-
-    UThreadSocket_t *socket = list[0];
+//所有socket记录同一个协程和等待的事件，任意一个就绪或者超时时唤醒协程，不再创建临时的epoll.
+//定时器挂在list[0]上，唤醒后根据缓存的就绪状态统计就绪的socket.
+//边缘触发的缓存只在IO返回EAGAIN时清除，可能已经过期，所以缓存为就绪的socket先用一次poll确认，
+//确认没有就绪的清除缓存，之后新到的数据会产生新的边缘事件
+int UThreadPoll(UThreadSocket_t *list[], int count, const int timeout_ms, const int events) {
+    if (count <= 0)
+        return 0;
 
-    int epollfd = epoll_create(count);
+    int nfds{0};
+    std::vector<struct pollfd> poll_list;
+    std::vector<UThreadSocket_t *> poll_socket_list;
+    for (int i = 0; i < count; i++) {
+        if (list[i]->ready_events & (events | EPOLLERR | EPOLLHUP)) {
+            poll_list.push_back({list[i]->socket, (short) events, 0});
+            poll_socket_list.push_back(list[i]);
+        }
+    }
 
-    for (int i = 0; i < count; i++)
-        epoll_ctl(epollfd, EPOLL_CTL_ADD, list[i]->socket, &(list[i]->event));
+    if (!poll_list.empty()) {
+        if (poll(poll_list.data(), poll_list.size(), 0) < 0)
+            return -1;
 
-    UThreadSocket_t fake_socket;
-    fake_socket.scheduler = socket->scheduler;
-    fake_socket.socket = epollfd;
-    fake_socket.uthread_id = socket->scheduler->GetCurrUThread();
-    fake_socket.event.events = EPOLLIN | EPOLLERR | EPOLLHUP;
-    fake_socket.event.data.ptr = &fake_socket;
-    fake_socket.waited_events = 0;
+        for (size_t i = 0; i < poll_list.size(); i++) {
+            //poll和epoll的事件位在Linux上相同
+            if (poll_list[i].revents != 0)
+                nfds++;
+            else
+                poll_socket_list[i]->ready_events &= ~events;
+        }
+    }
 
-    epoll_ctl(socket->epoll_fd, EPOLL_CTL_ADD, epollfd, &(fake_socket.event));
+    if (nfds == 0) {
+        UThreadSocket_t *socket = list[0];
+        int uthread_id = socket->scheduler->GetCurrUThread();
 
-    socket->scheduler->YieldTask();
+        for (int i = 0; i < count; i++) {
+            if (UThreadSocketRegister(*list[i]) != 0) {
+                for (int j = 0; j < i; j++)
+                    list[j]->poll_events = 0;
+                return -1;
+            }
+            list[i]->uthread_id = uthread_id;
+            list[i]->poll_events = events;
+        }
 
-    if (0 != (EPOLLIN & fake_socket.waited_events)) {
-        struct epoll_event *events = (struct epoll_event *) calloc (count, sizeof(struct epoll_event));
+        socket->waited_events = UThreadEpollREvent_Timeout;
+        socket->scheduler->AddTimer(socket, timeout_ms);
+        socket->scheduler->YieldTask();
 
-        nfds = epoll_wait(epollfd, events, count, 0);
+        //先清除所有socket等待的事件，同一批epoll事件中的其他socket就不会再唤醒该协程
+        for (int i = 0; i < count; i++)
+            list[i]->poll_events = 0;
+        socket->scheduler->RemoveTimer(socket->timer_id);
 
-        for (int i = 0; i < nfds; i++) {
-            UThreadSocket_t *socket = (UThreadSocket_t *) events[i].data.ptr;
-            socket->waited_events = events[i].events;
+        if (socket->waited_events == UThreadEpollREvent_Error) {
+            errno = ECONNREFUSED;
+            return -1;
         }
+        else if (socket->waited_events == UThreadEpollREvent_Close) {
+            //active close
+            errno = 0;
+            return -1;
+        }
+    }
+
+    nfds = 0;
+    for (int i = 0; i < count; i++) {
+        list[i]->waited_events = list[i]->ready_events & (events | EPOLLERR | EPOLLHUP);
+        if (list[i]->waited_events != 0)
+            nfds++;
     }
-    else if (fake_socket.waited_events == 0) 
-        nfds = 0;
 
-    close (epollfd);
+    if (nfds == 0)
+        errno = ETIMEDOUT;
 
     return nfds;
 }
 
+//没有空闲的SQE提交取消请求时，隔这么久再重试
+static const int UTHREAD_URING_CANCEL_RETRY_MS = 1;
+
+//调度器因为关闭或者出错退出了循环，不会再处理完成事件，在这里阻塞等待socket的操作完成.
+//其他socket的完成事件只记录结果，它们随后被ResumeAll唤醒时会看到操作已经完成
+static void UThreadUringDrain(UThreadSocket_t &socket, bool cancelled) {
+    UThreadUring *uring = socket.scheduler->GetUring();
+    uint64_t user_data{0};
+    int res{0};
+    while (socket.uring_pending) {
+        if (!cancelled)
+            cancelled = uring->Cancel((uint64_t) &socket);
+
+        if (uring->WaitCqe() < 0) {
+            //log
+            return;
+        }
+
+        while (uring->PopCqe(&user_data, &res)) {
+            if (user_data == 0)
+                continue;
+
+            UThreadSocket_t *done_socket = (UThreadSocket_t *) user_data;
+            done_socket->uring_res = res;
+            done_socket->uring_pending = false;
+        }
+    }
+}
+
+//等待已经放入io_uring的操作完成，返回操作的结果.
+//超时、关闭或者出错时会取消该操作，并且一直等到它的完成事件，因为在此之前内核仍可能访问socket和缓冲区.
+//取消请求提交不了时定时重试，等待期间一直有定时器，调度器关闭时也能被ResumeAll唤醒
+static ssize_t UThreadUringWait(UThreadSocket_t &socket, const int timeout_ms) {
+    socket.uthread_id = socket.scheduler->GetCurrUThread();
+    socket.uring_pending = true;
+    socket.waited_events = UThreadEpollREvent_Timeout;
+
+    socket.scheduler->AddTimer(&socket, timeout_ms);
+    socket.scheduler->YieldTask();
+
+    int wake_reason = socket.waited_events;
+    bool cancelled = false;
+    while (socket.uring_pending) {
+        if (socket.waited_events == UThreadEpollREvent_Error ||
+            socket.waited_events == UThreadEpollREvent_Close) {
+            wake_reason = socket.waited_events;
+            UThreadUringDrain(socket, cancelled);
+            break;
+        }
+
+        if (!cancelled)
+            cancelled = socket.scheduler->GetUring()->Cancel((uint64_t) &socket);
+
+        socket.waited_events = UThreadEpollREvent_Timeout;
+        socket.scheduler->AddTimer(&socket, cancelled ? -1 : UTHREAD_URING_CANCEL_RETRY_MS);
+        socket.scheduler->YieldTask();
+    }
+    socket.scheduler->RemoveTimer(socket.timer_id);
+
+    if (wake_reason == UThreadEpollREvent_Error) {
+        errno = ECONNREFUSED;
+        return -1;
+    }
+    else if (wake_reason == UThreadEpollREvent_Close) {
+        //active close
+        errno = 0;
+        return -1;
+    }
+
+    //取消之前操作已经完成时，仍然返回操作的结果
+    if (cancelled && socket.uring_res == -ECANCELED) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    if (socket.uring_res < 0) {
+        errno = -socket.uring_res;
+        return -1;
+    }
+
+    return socket.uring_res;
+}
+
+//使用io_uring时，内核对非阻塞fd的操作可能返回EAGAIN或EINPROGRESS，这时退回到epoll的方式
 int UThreadConnect(UThreadSocket_t &socket, const struct sockaddr *addr, socklen_t addrlen) {
-    int ret = connect(socket.socket, addr, addrlen);
+    int ret{-1};
+    UThreadUring *uring{socket.scheduler->GetUring()};
+    struct io_uring_sqe *sqe{uring != nullptr ? uring->GetSqe() : nullptr};
+    if (sqe != nullptr) {
+        UThreadUring::PrepConnect(sqe, socket.socket, addr, addrlen, (uint64_t) &socket);
+        ret = (int) UThreadUringWait(socket, socket.connect_timeout_ms);
+    }
+    else 
+        ret = connect(socket.socket, addr, addrlen);
 
     if (ret != 0) {
         if (errno != EAGAIN && errno != EINPROGRESS)
             return -1;
 
+        //连接尚未建立，之前缓存的就绪状态已经无效
+        socket.ready_events = 0;
+
         int revents = 0;
         if (UThreadPoll(socket, EPOLLOUT, &revents, socket.connect_timeout_ms) > 0) {
             ret = 0;
@@ -512,11 +961,21 @@ int UThreadConnect(UThreadSocket_t &socket, const struct sockaddr *addr, socklen
 }
 
 int UThreadAccept(UThreadSocket_t &socket, struct sockaddr *addr, socklen_t *addrlen) {
+    UThreadUring *uring{socket.scheduler->GetUring()};
+    struct io_uring_sqe *sqe{uring != nullptr ? uring->GetSqe() : nullptr};
+    if (sqe != nullptr) {
+        UThreadUring::PrepAccept(sqe, socket.socket, addr, addrlen, (uint64_t) &socket);
+        int ret = (int) UThreadUringWait(socket, -1);
+        if (ret >= 0 || errno != EAGAIN)
+            return ret;
+    }
+
     int ret = accept(socket.socket, addr, addrlen);
     if (ret < 0) {
         if (errno != EAGAIN && errno != EWOULDBLOCK)
             return -1;
 
+        socket.ready_events &= ~EPOLLIN;
         int revents = 0;
         if (UThreadPoll(socket, EPOLLIN, &revents, -1) > 0) {
             ret = accept(socket.socket, addr, addrlen);
@@ -528,10 +987,41 @@ int UThreadAccept(UThreadSocket_t &socket, struct sockaddr *addr, socklen_t *add
     return ret;
 }
 
+//用accept4一次接受最多max_count个链接，只在一个链接都没有时才切出协程.
+//listen socket上就绪的缓存只在accept4返回EAGAIN时清除
+int UThreadAcceptBatch(UThreadSocket_t &socket, int fd_list[], const int max_count, const int flags) {
+    int count{0};
+    while (count < max_count) {
+        int fd = accept4(socket.socket, nullptr, nullptr, flags);
+        if (fd >= 0) {
+            fd_list[count++] = fd;
+            continue;
+        }
+
+        //链接在被接受之前已经被客户端重置，继续接受下一个
+        if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return count > 0 ? count : -1;
+
+        socket.ready_events &= ~EPOLLIN;
+        if (count > 0)
+            break;
+
+        int revents = 0;
+        if (UThreadPoll(socket, EPOLLIN, &revents, -1) <= 0)
+            return -1;
+    }
+
+    return count;
+}
+
 ssize_t UThreadRead(UThreadSocket_t &socket, void *buf, size_t len, const int flags) {
     int ret = read(socket.socket, buf, len);
 
     if (ret < 0 && errno == EAGAIN) {
+        socket.ready_events &= ~EPOLLIN;
         int revents = 0;
         if (UThreadPoll(socket, EPOLLIN, &revents, socket.socket_timeout_ms) > 0) {
             ret = read(socket.socket, buf, len);
@@ -544,9 +1034,19 @@ ssize_t UThreadRead(UThreadSocket_t &socket, void *buf, size_t len, const int fl
 }
 
 ssize_t UThreadRecv(UThreadSocket_t &socket, void *buf, size_t len, const int flags) {
+    UThreadUring *uring{socket.scheduler->GetUring()};
+    struct io_uring_sqe *sqe{uring != nullptr ? uring->GetSqe() : nullptr};
+    if (sqe != nullptr) {
+        UThreadUring::PrepRecv(sqe, socket.socket, buf, len, flags, (uint64_t) &socket);
+        ssize_t ret = UThreadUringWait(socket, socket.socket_timeout_ms);
+        if (ret >= 0 || errno != EAGAIN)
+            return ret;
+    }
+
     int ret = recv(socket.socket, buf, len, flags);
 
     if (ret < 0 && errno == EAGAIN) {
+        socket.ready_events &= ~EPOLLIN;
         int revents = 0;
         if (UThreadPoll(socket, EPOLLIN, &revents, socket.socket_timeout_ms) > 0) {
             ret = recv(socket.socket, buf, len, flags);
@@ -559,9 +1059,19 @@ ssize_t UThreadRecv(UThreadSocket_t &socket, void *buf, size_t len, const int fl
 }
 
 ssize_t UThreadSend(UThreadSocket_t &socket, const void *buf, size_t len, const int flags) {
+    UThreadUring *uring{socket.scheduler->GetUring()};
+    struct io_uring_sqe *sqe{uring != nullptr ? uring->GetSqe() : nullptr};
+    if (sqe != nullptr) {
+        UThreadUring::PrepSend(sqe, socket.socket, buf, len, flags, (uint64_t) &socket);
+        ssize_t ret = UThreadUringWait(socket, socket.socket_timeout_ms);
+        if (ret >= 0 || errno != EAGAIN)
+            return ret;
+    }
+
     int ret = send(socket.socket, buf, len, flags);
 
     if (ret < 0 && errno == EAGAIN) {
+        socket.ready_events &= ~EPOLLOUT;
         int revents = 0;
         if (UThreadPoll(socket, EPOLLOUT, &revents, socket.socket_timeout_ms) > 0) {
             ret = send(socket.socket, buf, len, flags);
@@ -573,7 +1083,9 @@ ssize_t UThreadSend(UThreadSocket_t &socket, const void *buf, size_t len, const
     return ret;
 }
 
+//close会将fd从epoll中自动移除，不需要再调用epoll_ctl
 int UThreadClose(UThreadSocket_t &socket) {
+    socket.epoll_registered = false;
     if (socket.socket >= 0) 
         return close(socket.socket);
     return -1;
@@ -591,11 +1103,15 @@ int UThreadSocketFd(UThreadSocket_t &socket) {
     return socket.socket;
 }
 
-size_t UThreadSocketTImerID(UThreadSocket_t &socket) {
+int UThreadSocketWaitedEvents(UThreadSocket_t &socket) {
+    return socket.waited_events;
+}
+
+size_t UThreadSocketTimerID(UThreadSocket_t &socket) {
     return socket.timer_id;
 }
 
-void UTHreadSocketSetTimerID(UThreadSocket_t &socket, size_t timer_id) {
+void UThreadSocketSetTimerID(UThreadSocket_t &socket, size_t timer_id) {
     socket.timer_id = timer_id;
 }
 
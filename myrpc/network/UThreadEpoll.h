@@ -6,17 +6,30 @@
 
 #include "Timer.h"
 #include "UThreadRuntime.h"
+#include <atomic>
+#include <ctime>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <queue>
 #include <vector>
 #include <arpa/inet.h>
+#include <sys/epoll.h>
 
 namespace myrpc {
 
 //封装了协程的调度
 class UThreadEpollScheduler;
+class UThreadUring;
+struct UThreadWaiter;
+
+//调度器的IO后端，内核不支持io_uring时URING会自动退回到EPOLL
+enum class IOBackend {
+    EPOLL = 0,
+    URING,
+};
 
 typedef struct tagUThreadSocket UThreadSocket_t;
 
@@ -25,19 +38,38 @@ typedef std::pair<UThreadEpollScheduler *, int> UThreadEpollArgs_t;
 typedef std::function<UThreadSocket_t *()> UThreadActiveSocket_t;
 typedef std::function<void()> UThreadHandlerAcceptedFdFunc_t;
 typedef std::function<void()> UThreadHandlerNewRequest_t;
-
+typedef std::function<bool()> UThreadHasPendingWork_t;
+typedef std::function<void(const bool)> UThreadSleep_t;
+typedef std::function<void(const time_t)> UThreadSecond_t;
+
+/* 用eventfd唤醒调度器的epoll_wait.
+ * eventfd直接注册在调度器的epoll中，由调度器在事件循环里读取，
+ * signalled_标记已经写入eventfd但还没有被读取，
+ * 两次循环之间任意多次的Notify只会产生一次write. */
 class EpollNotifier final {
 public:
     EpollNotifier(UThreadEpollScheduler *scheduler);
     ~EpollNotifier();
 
-    void Run();
-    void Func();
+    int fd() const;
+    //读空eventfd，之后的Notify会重新写eventfd
+    void Consume();
+    //只有调度器阻塞在epoll_wait中且还没有被通知过时才写eventfd
     void Notify();
 
+    //调度器在阻塞的epoll_wait之前调用，返回false时说明已经有新的通知，不能阻塞
+    bool PrepareSleep();
+    //epoll_wait返回后调用，之后的通知由本轮循环的轮询处理
+    void FinishSleep();
+
 private:
     UThreadEpollScheduler  *scheduler_{nullptr};
-    int pipe_fds_[2];
+    int event_fd_{-1};
+    std::atomic_bool signalled_{false};
+    //调度器是否可能阻塞在epoll_wait中
+    std::atomic_bool sleeping_{false};
+    //上一次epoll_wait返回之后是否有过通知
+    std::atomic_bool notified_{false};
 };
 
 class UThreadNotifier final {
@@ -52,7 +84,7 @@ public:
 private:
     UThreadEpollScheduler *scheduler_ {nullptr};
     UThreadSocket_t *socket_{nullptr};
-    int pipe_fds_[2];
+    int event_fd_{-1};
     void *data_{nullptr};
 };
 
@@ -73,12 +105,22 @@ private:
 
 class UThreadEpollScheduler final {
 public:
-    UThreadEpollScheduler(size_t stack_size, int max_task, const bool need_stack_protect = true);
+    //timer_type选择管理超时的定时器，大量长连接时使用时间轮
+    //io_backend为URING时，recv/send/accept/connect通过io_uring提交，协程在操作完成后被唤醒
+    //shared_stack_count大于0时协程运行在共享栈上，每个共享栈大小为stack_size，此时不使用io_uring
+    //私有栈模式下栈池最多保留max_task个空闲的栈，可以用SetMaxFreeStackCount调整
+    UThreadEpollScheduler(size_t stack_size, int max_task, const bool need_stack_protect = true,
+        const TimerType timer_type = TimerType::HEAP, const IOBackend io_backend = IOBackend::EPOLL,
+        const size_t shared_stack_count = 0);
     ~UThreadEpollScheduler();
 
     static UThreadEpollScheduler *Instance();
+    //当前线程正在Run的调度器，没有时返回nullptr
+    static UThreadEpollScheduler *GetCurrentScheduler();
 
     bool IsTaskFull();
+    //还可以创建的协程数
+    int GetFreeTaskCount();
 
     //将任务添加到todo_list_中
     void AddTask(UThreadFunc_t func, void *args);
@@ -92,23 +134,62 @@ public:
 
     void SetHandlerNewRequestFunc(UThreadHandlerNewRequest_t handler_new_request_func);
 
+    //返回true时表示还有不依赖事件就能继续处理的工作，epoll_wait不会阻塞
+    void SetHasPendingWorkFunc(UThreadHasPendingWork_t has_pending_work_func);
+
+    //调度器要阻塞在epoll_wait中时以true调用，epoll_wait返回后以false调用
+    void SetSleepFunc(UThreadSleep_t sleep_func);
+
+    //墙上时间的秒数变化时调用，在epoll_wait返回之后、处理事件之前，参数为当前时间.
+    //用于每个线程每秒刷新一次的缓存，比如http的Date头部
+    void SetSecondFunc(UThreadSecond_t second_func);
+
+    //大于0时，最近一次有事件之后的busy_poll_us微秒内epoll_wait不阻塞，用CPU换取延迟
+    void SetBusyPollUS(const int busy_poll_us);
+
     //切出任务
     bool YieldTask();
 
+    //切出当前协程，等调度器处理完已经就绪的事件和新加入的任务后再Resume，
+    //用于一次处理不完的工作让出CPU
+    void DeferTask();
+
     /* Run函数先会将任务队列中的函数创建为协程，并Resume切换到协程，协程中会将fd的相应操作在epoll中注册，
      * 然后Yield回到回到Run. Run函数检查活动的fd，并Resume到活动的协程中进行IO操作. */
     bool Run();
 
-    /* 首先调用EpollNotifier的Run函数，将Func函数加入调度器的任务队列，Func函数会读取管道，唤醒epoll.
-    * 下一步会将任务队列中的函数创建为协程，并Resume切换到协程，协程中会将fd的相应操作在epoll中注册，
-    * 然后Yield回到回到Run. Run函数检查活动的fd，并Resume到活动的协程中进行IO操作. */
+    //和Run相同，但所有协程都结束后也不退出，直到调用Close
     void RunForever();
 
+    //关闭时只Resume有定时器的协程. 在同步原语上等待的协程没有定时器，不会被唤醒，
+    //Close之前必须让它们全部离开同步原语，见GetSyncWaiterCount
     void Close();
 
+    //可以在任意线程调用，唤醒调度器，多次调用会被合并，不会丢失
     void NotifyEpoll();
 
+    //唤醒一个等待在同步原语上的本调度器的协程，可以在任意线程调用
+    void WakeUp(UThreadWaiter *waiter);
+    //本调度器的协程中正在同步原语上等待的数目，只在本调度器的线程中修改
+    void AddSyncWaiterCount(const int count);
+    int GetSyncWaiterCount() const;
+
     int GetCurrUThread();
+    //共享栈模式下切出的协程拷贝出来的栈数据的总大小
+    size_t GetSharedStackSavedBytes() const;
+    //私有栈的栈池，可以读取空闲、使用中和驻留内存的统计
+    const UThreadStackPool &GetStackPool() const;
+    //栈池最多保留的空闲栈数，超出的栈连同保护页一起munmap
+    void SetMaxFreeStackCount(const size_t max_free_stack_count);
+
+    //没有使用io_uring或者内核不支持时返回nullptr
+    UThreadUring *GetUring();
+
+    //上一秒中事件循环被唤醒的次数
+    int GetLoopWakeupsPerSecond() const;
+    //上一秒中定时器实际被处理的时间比到期时间晚的最大值和平均值
+    int GetTimerLatenessMaxUS() const;
+    int GetTimerLatenessAvgUS() const;
 
     void AddTimer(UThreadSocket_t *socket, const int timeout_ms);
     void RemoveTimer(const size_t timer_id);
@@ -123,24 +204,55 @@ private:
     void ConsumeTodoList();
     void ResumeAll(int flag);
     void StatEpollwaitEvents(const int event_count);
+    //计算epoll_wait的超时时间
+    int GetEpollTimeout(const int next_timeout);
+    //读取io_uring的完成事件，并Resume到对应的协程
+    void ReapUring();
+    //Resume被同步原语唤醒的协程
+    void DealwithWakeUp();
 
     UThreadRuntime runtime_;
     int max_task_;
     TaskQueue todo_list_;
     int epoll_fd_;
 
-    Timer timer_;
+    std::unique_ptr<TimerBase> timer_;
+    std::unique_ptr<UThreadUring> uring_;
     bool closed_{false};
     bool run_forever_{false};
 
+    //被同步原语唤醒，等待Resume的协程
+    std::mutex wakeup_mutex_;
+    std::vector<UThreadWaiter *> wakeup_list_;
+    std::atomic_bool has_wakeup_{false};
+    int sync_waiter_count_{0};
+
     UThreadActiveSocket_t  active_socket_func_;
     UThreadHandlerAcceptedFdFunc_t handler_accepted_fd_func_;
     UThreadHandlerNewRequest_t handler_new_request_func_;
+    UThreadHasPendingWork_t has_pending_work_func_;
+    UThreadSleep_t sleep_func_;
+    UThreadSecond_t second_func_;
+    time_t last_second_{0};
+
+    int busy_poll_us_{0};
+    uint64_t last_active_us_{0};
+    //下一个定时器的到期时间，为0时表示没有会到期的定时器
+    uint64_t next_deadline_ms_{0};
 
     int epoll_wait_events_;
     int epoll_wait_events_per_second_;
     uint64_t epoll_wait_events_last_cal_time_;
 
+    int loop_wakeups_{0};
+    uint64_t timer_lateness_sum_us_{0};
+    int timer_lateness_count_{0};
+    int timer_lateness_max_us_{0};
+    //在其他线程中读取的统计结果
+    std::atomic_int loop_wakeups_per_second_{0};
+    std::atomic_int timer_lateness_max_us_per_second_{0};
+    std::atomic_int timer_lateness_avg_us_per_second_{0};
+
     EpollNotifier epoll_wake_up_;
 };
 
@@ -172,18 +284,23 @@ private:
 #define uthread_end _uthread_scheduler.Run();
 
 
-//UThreadPoll负责注册对应事件之后Yield, Resume回来后删除注册
+//UThreadPoll负责等待对应事件，socket在第一次等待时以边缘触发的方式持久注册到epoll中，
+//之后的等待只记录协程等待的方向然后Yield，不再调用epoll_ctl
 //接受一个socket的版本 
-//epoll_ctl注册对应事件后Yield，Resume回来后删除注册
 int UThreadPoll(UThreadSocket_t &socket, int events, int *revents, const int timeout_ms);
 
-//接受一组socket的版本 
-int UThreadPoll(UThreadSocket_t *list[], int count, const int timeout_ms);
+//接受一组socket的版本，等待任意一个socket上的events事件，不创建临时的epoll.
+//返回就绪的socket数目，就绪的socket的waited_events为就绪的事件，其余为0；超时返回0
+int UThreadPoll(UThreadSocket_t *list[], int count, const int timeout_ms, const int events = EPOLLIN);
 
 int UThreadConnect(UThreadSocket_t &socket, const struct sockaddr *addr, socklen_t addrlen);
 
 int UThreadAccept(UThreadSocket_t &socket, struct sockaddr *addr, socklen_t *addrlen);
 
+//用accept4一次接受最多max_count个链接，flags为accept4的flags，没有等待中的链接时切出协程.
+//返回接受的链接数，出错时返回-1
+int UThreadAcceptBatch(UThreadSocket_t &socket, int fd_list[], const int max_count, const int flags);
+
 ssize_t UThreadRecv(UThreadSocket_t &socket, void *buf, size_t len, const int flags);
 
 ssize_t UThreadRead(UThreadSocket_t &socket, void *buf, size_t len, const int flags);
@@ -198,6 +315,9 @@ void UThreadSetSocketTimeout(UThreadSocket_t &socket, const int socket_timeout_m
 
 int UThreadSocketFd(UThreadSocket_t &socket);
 
+//最近一次UThreadPoll中该socket上就绪的事件
+int UThreadSocketWaitedEvents(UThreadSocket_t &socket);
+
 size_t UThreadSocketTimerID(UThreadSocket_t &socket);
 
 void UThreadSocketSetTimerID(UThreadSocket_t &socket, size_t timer_id);
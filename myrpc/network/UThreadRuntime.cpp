@@ -4,6 +4,8 @@
 
 #include "UThreadRuntime.h"
 #include "UThreadContextSystem.h"
+#include "UThreadContextAsm.h"
+#include "UThreadContextShared.h"
 #include <unistd.h>
 #include <assert.h>
 
@@ -16,11 +18,29 @@ enum {
 
 namespace myrpc {
 
-UThreadRuntime::UThreadRuntime(size_t stack_size, const bool need_stack_protect)
+UThreadRuntime::UThreadRuntime(size_t stack_size, const bool need_stack_protect, const size_t shared_stack_count,
+    const size_t max_free_stack_count)
     : stack_size_(stack_size), first_done_item_(-1), current_uthread_(-1), 
-        unfinished_item_count_(0), need_stack_protect_(need_stack_protect) {
-    if (UThreadContext::GetContextCreateFunc() == nullptr)
-        UThreadContext::SetContextCreateFunc(UThreadContextSystem::DoCreate);
+        unfinished_item_count_(0), need_stack_protect_(need_stack_protect),
+        stack_pool_(stack_size, need_stack_protect, max_free_stack_count) {
+    //没有设置时默认使用汇编实现的上下文切换，当前平台不支持时使用ucontext
+    if (UThreadContext::GetContextCreateFunc() == nullptr) {
+        if (UThreadContextAsm::IsSupported())
+            UThreadContext::SetContextCreateFunc(UThreadContextAsm::DoCreate);
+        else
+            UThreadContext::SetContextCreateFunc(UThreadContextSystem::DoCreate);
+    }
+
+    context_create_func_ = UThreadContext::GetContextCreateFunc();
+
+    if (shared_stack_count > 0 && UThreadContextAsm::IsSupported()) {
+        shared_stack_pool_.reset(new UThreadSharedStackPool(stack_size, shared_stack_count, need_stack_protect));
+        UThreadSharedStackPool *pool = shared_stack_pool_.get();
+        context_create_func_ = [pool](UThreadStackPool */*stack_pool*/, UThreadFunc_t func, void *args,
+            UThreadDoneCallback_t callback) -> UThreadContext * {
+                return new UThreadContextShared(pool, func, args, callback);
+        };
+    }
 }
 
 UThreadRuntime::~UThreadRuntime() {
@@ -45,8 +65,8 @@ int UThreadRuntime::Create(UThreadFunc_t func, void *args) {
     else {
         //若当前没有已执行完的协程，则在ContextSlot中添加一个Slot
         index = context_list_.size();
-        auto new_context = UThreadContext::Create(stack_size_, func, args,
-            std::bind(&UThreadRuntime::UThreadDoneCallback, this), need_stack_protect_);
+        auto new_context = context_create_func_(&stack_pool_, func, args,
+            std::bind(&UThreadRuntime::UThreadDoneCallback, this));
         assert(new_context != nullptr);
         ContextSlot context_slot;
         context_slot.context = new_context;
@@ -110,4 +130,18 @@ int UThreadRuntime::GetUnfinishedItemCount() const {
     return unfinished_item_count_;
 }
 
+const UThreadStackPool &UThreadRuntime::GetStackPool() const {
+    return stack_pool_;
+}
+
+void UThreadRuntime::SetMaxFreeStackCount(const size_t max_free_stack_count) {
+    stack_pool_.SetMaxFree(max_free_stack_count);
+}
+
+size_t UThreadRuntime::GetSharedStackSavedBytes() const {
+    if (shared_stack_pool_ == nullptr)
+        return 0;
+    return shared_stack_pool_->GetSavedBytes();
+}
+
 }
\ No newline at end of file
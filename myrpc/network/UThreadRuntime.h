@@ -5,13 +5,20 @@
 #pragma once 
 
 #include "UThreadContextBase.h"
+#include "UThreadContextUtil.h"
+#include <memory>
 #include <vector>
 
 namespace myrpc {
 
+class UThreadSharedStackPool;
+
 class UThreadRuntime  {
 public:
-    UThreadRuntime(size_t stack_size, const bool need_stack_protect);
+    //shared_stack_count大于0时使用共享栈模式，所有协程运行在shared_stack_count个大小为stack_size的共享栈上，
+    //平台不支持汇编上下文切换时仍使用私有栈. 私有栈模式下最多保留max_free_stack_count个空闲的栈
+    UThreadRuntime(size_t stack_size, const bool need_stack_protect, const size_t shared_stack_count = 0,
+        const size_t max_free_stack_count = 1024);
     ~UThreadRuntime();
 
     //创建一个上下文
@@ -23,6 +30,12 @@ public:
     bool Resume(size_t index);
     bool IsAllDone();
     int GetUnfinishedItemCount() const;
+    //共享栈模式下切出的协程拷贝出来的栈数据的总大小
+    size_t GetSharedStackSavedBytes() const;
+    //私有栈模式下的栈池，可以读取空闲、使用中和驻留内存的统计
+    const UThreadStackPool &GetStackPool() const;
+    //调整栈池保留的空闲栈数，多出的栈立即munmap
+    void SetMaxFreeStackCount(const size_t max_free_stack_count);
 
     void UThreadDoneCallback();
 
@@ -46,6 +59,11 @@ private:
     int current_uthread_;
     int unfinished_item_count_;
     bool need_stack_protect_;
+    //私有栈模式下回收复用协程的栈
+    UThreadStackPool stack_pool_;
+    //本runtime使用的上下文创建函数
+    ContextCreateFunc_t context_create_func_;
+    std::unique_ptr<UThreadSharedStackPool> shared_stack_pool_;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,227 @@
+/* 定义了协程的同步原语UThreadMutex、UThreadCondVar和UThreadSemaphore.
+ * 在协程中等待时只切出当前协程，不会阻塞整个线程；
+ * 唤醒时把等待者交给它所属的调度器，由调度器在自己的线程中Resume该协程，
+ * 所以可以在不同线程的协程之间，以及协程和普通线程之间使用.
+ * 不在协程中调用时，退化为阻塞当前线程.
+ * 每次等待都会在堆上分配一个UThreadWaiter，等待者按先后顺序被唤醒.
+ * 等待没有超时，调度器关闭时也不会唤醒等待的协程，调度器Close之前必须先让所有等待者离开，
+ * 调度器在关闭时断言本调度器上没有等待者.
+ * */
+
+#include "UThreadSync.h"
+#include "UThreadEpoll.h"
+
+namespace myrpc {
+
+UThreadWaitQueue::UThreadWaitQueue() {
+
+}
+
+UThreadWaitQueue::~UThreadWaitQueue() {
+
+}
+
+//创建一个当前协程或者当前线程的等待者
+UThreadWaiter *UThreadWaitQueue::CreateWaiter() {
+    UThreadWaiter *waiter = new UThreadWaiter;
+    UThreadEpollScheduler *scheduler = UThreadEpollScheduler::GetCurrentScheduler();
+    if (scheduler != nullptr && scheduler->GetCurrUThread() != -1) {
+        waiter->scheduler = scheduler;
+        waiter->uthread_id = scheduler->GetCurrUThread();
+        scheduler->AddSyncWaiterCount(1);
+    }
+
+    return waiter;
+}
+
+//挂起直到等待者被唤醒.
+//协程的signalled只会由所属调度器在Resume之前设置，被其他原因Resume时继续切出
+void UThreadWaitQueue::Wait(UThreadWaiter *waiter) {
+    if (waiter->scheduler != nullptr) {
+        while (!waiter->signalled)
+            waiter->scheduler->YieldTask();
+        waiter->scheduler->AddSyncWaiterCount(-1);
+    }
+    else {
+        std::unique_lock<std::mutex> lock(waiter->mutex);
+        while (!waiter->signalled)
+            waiter->cond.wait(lock);
+    }
+
+    delete waiter;
+}
+
+//唤醒一个等待者，协程交给所属的调度器唤醒
+void UThreadWaitQueue::Signal(UThreadWaiter *waiter) {
+    if (waiter->scheduler != nullptr) {
+        waiter->scheduler->WakeUp(waiter);
+    }
+    else {
+        std::lock_guard<std::mutex> lock(waiter->mutex);
+        waiter->signalled = true;
+        waiter->cond.notify_one();
+    }
+}
+
+void UThreadWaitQueue::Push(UThreadWaiter *waiter) {
+    waiter_list_.push_back(waiter);
+}
+
+UThreadWaiter *UThreadWaitQueue::Pop() {
+    if (waiter_list_.empty())
+        return nullptr;
+
+    UThreadWaiter *waiter = waiter_list_.front();
+    waiter_list_.pop_front();
+    return waiter;
+}
+
+bool UThreadWaitQueue::empty() const {
+    return waiter_list_.empty();
+}
+
+UThreadMutex::UThreadMutex() {
+
+}
+
+UThreadMutex::~UThreadMutex() {
+
+}
+
+void UThreadMutex::Lock() {
+    UThreadWaiter *waiter = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!locked_) {
+            locked_ = true;
+            return;
+        }
+
+        waiter = UThreadWaitQueue::CreateWaiter();
+        wait_queue_.Push(waiter);
+    }
+
+    //被唤醒时锁已经交给了当前等待者
+    UThreadWaitQueue::Wait(waiter);
+}
+
+bool UThreadMutex::TryLock() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (locked_)
+        return false;
+
+    locked_ = true;
+    return true;
+}
+
+//有等待者时直接把锁交给最先等待的一个，locked_保持为true
+void UThreadMutex::Unlock() {
+    UThreadWaiter *waiter = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        waiter = wait_queue_.Pop();
+        if (waiter == nullptr) {
+            locked_ = false;
+            return;
+        }
+    }
+
+    UThreadWaitQueue::Signal(waiter);
+}
+
+UThreadCondVar::UThreadCondVar() {
+
+}
+
+UThreadCondVar::~UThreadCondVar() {
+
+}
+
+//先放入等待队列再释放mutex，在两者之间调用的Signal不会丢失
+void UThreadCondVar::Wait(UThreadMutex &mutex) {
+    UThreadWaiter *waiter = UThreadWaitQueue::CreateWaiter();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wait_queue_.Push(waiter);
+    }
+
+    mutex.Unlock();
+    UThreadWaitQueue::Wait(waiter);
+    mutex.Lock();
+}
+
+void UThreadCondVar::Signal() {
+    UThreadWaiter *waiter = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        waiter = wait_queue_.Pop();
+    }
+
+    if (waiter != nullptr)
+        UThreadWaitQueue::Signal(waiter);
+}
+
+void UThreadCondVar::Broadcast() {
+    UThreadWaitQueue wait_queue;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        UThreadWaiter *waiter = nullptr;
+        while ((waiter = wait_queue_.Pop()) != nullptr)
+            wait_queue.Push(waiter);
+    }
+
+    UThreadWaiter *waiter = nullptr;
+    while ((waiter = wait_queue.Pop()) != nullptr)
+        UThreadWaitQueue::Signal(waiter);
+}
+
+UThreadSemaphore::UThreadSemaphore(const int count) : count_(count) {
+
+}
+
+UThreadSemaphore::~UThreadSemaphore() {
+
+}
+
+void UThreadSemaphore::Wait() {
+    UThreadWaiter *waiter = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (count_ > 0) {
+            count_--;
+            return;
+        }
+
+        waiter = UThreadWaitQueue::CreateWaiter();
+        wait_queue_.Push(waiter);
+    }
+
+    //被唤醒时计数已经交给了当前等待者
+    UThreadWaitQueue::Wait(waiter);
+}
+
+bool UThreadSemaphore::TryWait() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ <= 0)
+        return false;
+
+    count_--;
+    return true;
+}
+
+//有等待者时直接把计数交给最先等待的一个
+void UThreadSemaphore::Post() {
+    UThreadWaiter *waiter = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        waiter = wait_queue_.Pop();
+        if (waiter == nullptr) {
+            count_++;
+            return;
+        }
+    }
+
+    UThreadWaitQueue::Signal(waiter);
+}
+
+}
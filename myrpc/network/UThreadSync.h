@@ -0,0 +1,100 @@
+/* 定义了协程的同步原语UThreadMutex、UThreadCondVar和UThreadSemaphore.
+ * 在协程中等待时只切出当前协程，不会阻塞整个线程；
+ * 唤醒时把等待者交给它所属的调度器，由调度器在自己的线程中Resume该协程，
+ * 所以可以在不同线程的协程之间，以及协程和普通线程之间使用.
+ * 不在协程中调用时，退化为阻塞当前线程.
+ * 每次等待都会在堆上分配一个UThreadWaiter，等待者按先后顺序被唤醒.
+ * 等待没有超时，调度器关闭时也不会唤醒等待的协程，调度器Close之前必须先让所有等待者离开，
+ * 调度器在关闭时断言本调度器上没有等待者.
+ * */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace myrpc {
+
+class UThreadEpollScheduler;
+
+//一个等待者，scheduler为nullptr时表示一个被阻塞的普通线程
+struct UThreadWaiter {
+    UThreadEpollScheduler *scheduler{nullptr};
+    int uthread_id{-1};
+    //只在所属调度器的线程中或者mutex保护下修改
+    bool signalled{false};
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+//等待队列，保存等待者并负责挂起和唤醒
+class UThreadWaitQueue {
+public:
+    UThreadWaitQueue();
+    ~UThreadWaitQueue();
+
+    //创建一个当前协程或者当前线程的等待者
+    static UThreadWaiter *CreateWaiter();
+    //挂起直到等待者被唤醒，返回后等待者被删除
+    static void Wait(UThreadWaiter *waiter);
+    //唤醒一个等待者
+    static void Signal(UThreadWaiter *waiter);
+
+    void Push(UThreadWaiter *waiter);
+    //没有等待者时返回nullptr
+    UThreadWaiter *Pop();
+    bool empty() const;
+
+private:
+    std::deque<UThreadWaiter *> waiter_list_;
+};
+
+class UThreadMutex final {
+public:
+    UThreadMutex();
+    ~UThreadMutex();
+
+    void Lock();
+    bool TryLock();
+    //有等待者时直接把锁交给最先等待的一个
+    void Unlock();
+
+private:
+    std::mutex mutex_;
+    bool locked_{false};
+    UThreadWaitQueue wait_queue_;
+};
+
+class UThreadCondVar final {
+public:
+    UThreadCondVar();
+    ~UThreadCondVar();
+
+    //调用前需要持有mutex，返回时重新持有
+    void Wait(UThreadMutex &mutex);
+    void Signal();
+    void Broadcast();
+
+private:
+    std::mutex mutex_;
+    UThreadWaitQueue wait_queue_;
+};
+
+class UThreadSemaphore final {
+public:
+    UThreadSemaphore(const int count = 0);
+    ~UThreadSemaphore();
+
+    void Wait();
+    bool TryWait();
+    //有等待者时直接把计数交给最先等待的一个
+    void Post();
+
+private:
+    std::mutex mutex_;
+    int count_;
+    UThreadWaitQueue wait_queue_;
+};
+
+}
@@ -0,0 +1,220 @@
+/* 使用io_uring提交协程的IO操作，作为UThreadEpollScheduler的另一种IO后端.
+ * 直接使用io_uring_setup和io_uring_enter系统调用，不依赖liburing.
+ * 一次调度循环中产生的SQE会积累起来，在epoll_wait之前统一提交；
+ * CQE直接从共享内存中读取，不需要系统调用.
+ * io_uring的fd会注册到调度器的epoll中，有CQE时唤醒epoll_wait.
+ * */
+
+#include "UThreadUring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+namespace myrpc {
+
+UThreadUring::UThreadUring() {
+
+}
+
+UThreadUring::~UThreadUring() {
+    if (sqes_ != nullptr)
+        munmap(sqes_, sqes_size_);
+    if (cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+        munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != nullptr)
+        munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ >= 0)
+        close(ring_fd_);
+}
+
+//创建io_uring并映射队列，内核不支持时返回false
+bool UThreadUring::Init(const unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring_fd_ = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd_ < 0) {
+        //log
+        return false;
+    }
+
+    //需要内核在CQ满时不丢弃完成事件，并且对socket使用内部的poll而不是阻塞的工作线程
+    if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_FAST_POLL)) {
+        //log
+        close(ring_fd_);
+        ring_fd_ = -1;
+        return false;
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_ring_size_ > sq_ring_size_)
+            sq_ring_size_ = cq_ring_size_;
+        cq_ring_size_ = sq_ring_size_;
+    }
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+        sq_ring_ = nullptr;
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring_ = sq_ring_;
+    }
+    else {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            cq_ring_ = nullptr;
+            return false;
+        }
+    }
+
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = (struct io_uring_sqe *) mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = nullptr;
+        return false;
+    }
+
+    char *sq = (char *) sq_ring_;
+    sq_head_ = (unsigned *) (sq + params.sq_off.head);
+    sq_tail_ = (unsigned *) (sq + params.sq_off.tail);
+    sq_mask_ = (unsigned *) (sq + params.sq_off.ring_mask);
+    sq_array_ = (unsigned *) (sq + params.sq_off.array);
+    sq_entries_ = params.sq_entries;
+
+    char *cq = (char *) cq_ring_;
+    cq_head_ = (unsigned *) (cq + params.cq_off.head);
+    cq_tail_ = (unsigned *) (cq + params.cq_off.tail);
+    cq_mask_ = (unsigned *) (cq + params.cq_off.ring_mask);
+    cqes_ = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return true;
+}
+
+int UThreadUring::fd() const {
+    return ring_fd_;
+}
+
+//获得一个空闲的SQE，队列满时先提交已有的SQE
+struct io_uring_sqe *UThreadUring::GetSqe() {
+    unsigned tail = *sq_tail_ + to_submit_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        Submit();
+        tail = *sq_tail_ + to_submit_;
+        if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)
+            return nullptr;
+    }
+
+    unsigned index = tail & *sq_mask_;
+    struct io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    to_submit_++;
+
+    return sqe;
+}
+
+//提交积累的SQE，内核在io_uring_enter中会把它们全部取走
+int UThreadUring::Submit() {
+    if (to_submit_ == 0)
+        return 0;
+
+    return Enter(0, 0);
+}
+
+//提交积累的SQE，并阻塞到至少有一个CQE，CQ中已经有CQE时马上返回
+int UThreadUring::WaitCqe() {
+    return Enter(1, IORING_ENTER_GETEVENTS);
+}
+
+int UThreadUring::Enter(const unsigned min_complete, const unsigned flags) {
+    __atomic_store_n(sq_tail_, *sq_tail_ + to_submit_, __ATOMIC_RELEASE);
+    unsigned count = to_submit_;
+    to_submit_ = 0;
+
+    int ret = -1;
+    do {
+        ret = (int) syscall(__NR_io_uring_enter, ring_fd_, count, min_complete, flags, nullptr, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        //log
+    }
+
+    return ret;
+}
+
+//取出一个CQE，没有时返回false
+bool UThreadUring::PopCqe(uint64_t *user_data, int *res) {
+    unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+        return false;
+
+    struct io_uring_cqe *cqe = &cqes_[head & *cq_mask_];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+//取消user_data对应的操作，取消请求本身的CQE的user_data为0.
+//CQ满时内核不再接受SQE，GetSqe在提交后仍然可能没有空闲的SQE，这时返回false，由调用者稍后重试
+bool UThreadUring::Cancel(const uint64_t user_data) {
+    struct io_uring_sqe *sqe = GetSqe();
+    if (sqe == nullptr)
+        return false;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = 0;
+
+    return true;
+}
+
+void UThreadUring::PrepRecv(struct io_uring_sqe *sqe, int fd, void *buf, size_t len, int flags, uint64_t user_data) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) buf;
+    sqe->len = (uint32_t) len;
+    sqe->msg_flags = (uint32_t) flags;
+    sqe->user_data = user_data;
+}
+
+void UThreadUring::PrepSend(struct io_uring_sqe *sqe, int fd, const void *buf, size_t len, int flags, uint64_t user_data) {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) buf;
+    sqe->len = (uint32_t) len;
+    sqe->msg_flags = (uint32_t) flags;
+    sqe->user_data = user_data;
+}
+
+void UThreadUring::PrepAccept(struct io_uring_sqe *sqe, int fd, struct sockaddr *addr, socklen_t *addrlen, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) addr;
+    sqe->addr2 = (uint64_t) addrlen;
+    sqe->user_data = user_data;
+}
+
+void UThreadUring::PrepConnect(struct io_uring_sqe *sqe, int fd, const struct sockaddr *addr, socklen_t addrlen, uint64_t user_data) {
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) addr;
+    sqe->off = addrlen;
+    sqe->user_data = user_data;
+}
+
+}
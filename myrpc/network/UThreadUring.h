@@ -0,0 +1,69 @@
+/* 使用io_uring提交协程的IO操作，作为UThreadEpollScheduler的另一种IO后端.
+ * 直接使用io_uring_setup和io_uring_enter系统调用，不依赖liburing.
+ * 一次调度循环中产生的SQE会积累起来，在epoll_wait之前统一提交；
+ * CQE直接从共享内存中读取，不需要系统调用.
+ * io_uring的fd会注册到调度器的epoll中，有CQE时唤醒epoll_wait.
+ * */
+
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <cinttypes>
+#include <cstddef>
+
+namespace myrpc {
+
+class UThreadUring final {
+public:
+    UThreadUring();
+    ~UThreadUring();
+
+    //创建io_uring并映射队列，内核不支持时返回false
+    bool Init(const unsigned entries);
+    int fd() const;
+
+    //获得一个空闲的SQE，队列满时先提交已有的SQE
+    struct io_uring_sqe *GetSqe();
+    //提交积累的SQE
+    int Submit();
+    //提交积累的SQE，并阻塞到至少有一个CQE
+    int WaitCqe();
+    //取出一个CQE，没有时返回false
+    bool PopCqe(uint64_t *user_data, int *res);
+    //取消user_data对应的操作，取消请求本身的CQE的user_data为0. 没有空闲的SQE时返回false
+    bool Cancel(const uint64_t user_data);
+
+    static void PrepRecv(struct io_uring_sqe *sqe, int fd, void *buf, size_t len, int flags, uint64_t user_data);
+    static void PrepSend(struct io_uring_sqe *sqe, int fd, const void *buf, size_t len, int flags, uint64_t user_data);
+    static void PrepAccept(struct io_uring_sqe *sqe, int fd, struct sockaddr *addr, socklen_t *addrlen, uint64_t user_data);
+    static void PrepConnect(struct io_uring_sqe *sqe, int fd, const struct sockaddr *addr, socklen_t addrlen, uint64_t user_data);
+
+private:
+    int Enter(const unsigned min_complete, const unsigned flags);
+
+    int ring_fd_{-1};
+
+    void *sq_ring_{nullptr};
+    size_t sq_ring_size_{0};
+    void *cq_ring_{nullptr};
+    size_t cq_ring_size_{0};
+    struct io_uring_sqe *sqes_{nullptr};
+    size_t sqes_size_{0};
+
+    unsigned *sq_head_{nullptr};
+    unsigned *sq_tail_{nullptr};
+    unsigned *sq_mask_{nullptr};
+    unsigned *sq_array_{nullptr};
+    unsigned sq_entries_{0};
+
+    unsigned *cq_head_{nullptr};
+    unsigned *cq_tail_{nullptr};
+    unsigned *cq_mask_{nullptr};
+    struct io_uring_cqe *cqes_{nullptr};
+
+    //已经放入SQ但还没有提交给内核的SQE数目
+    unsigned to_submit_{0};
+};
+
+}
@@ -4,6 +4,7 @@
 
 #include "rpc/myrpc.pb.h"
 #include "rpc/MyServer.h"
+#include "rpc/Placement.h"
 #include "rpc/ServerBase.h"
 #include "rpc/ServerConfig.h"
 #include "rpc/ThreadQueue.h"
@@ -5,15 +5,20 @@
  * MyServerUnit，独立的工作单元，每个单元有一个工作线程池，协程调度器和数据流.
  * MyServerIO，在MyServerUnit线程处理IO事件.
  * MyServer内含多个MyServerUnit工作单元.
- * MyServerAcceptor接受链接，工作在主线程中.
+ * MyServerAcceptor接受链接，工作在主线程中；
+ * SO_REUSEPORT模式下只负责创建监听socket，链接由各个MyServerUnit的调度器接受.
  * */
 
 #include "MyServer.h"
 #include <assert.h>
+#include <algorithm>
 
 namespace myrpc {
 
-DataFlow::DataFlow() {
+//请求队列的长度在入队前已经被CanPushRequest限制在max_queue_length以内，
+//应答的数目不会超过正在处理的请求数，队列满时push会等待IO线程取走应答
+DataFlow::DataFlow(const int max_queue_length)
+    : in_queue_(max_queue_length), out_queue_(max_queue_length) {
 
 }
 
@@ -85,6 +90,60 @@ int DataFlow::PickResponse(void *&args, BaseResponse *&resp) {
     return now_time > rp.first.enqueue_time_ms ? now_time - rp.first.enqueue_time_ms : 0;
 }
 
+void DataFlow::PushRequests(void *const args_list[], BaseRequest *const req_list[], const int count) {
+    std::pair<QueueExtData, BaseRequest *> rp_list[DATA_FLOW_BATCH_SIZE];
+    auto now_time(Timer::GetSteadyClockMS());
+
+    for (int begin = 0; begin < count; begin += DATA_FLOW_BATCH_SIZE) {
+        int n = std::min(count - begin, DATA_FLOW_BATCH_SIZE);
+        for (int i = 0; i < n; i++)
+            rp_list[i] = std::make_pair(QueueExtData(args_list[begin + i], now_time), req_list[begin + i]);
+        in_queue_.push_batch(rp_list, (size_t) n);
+    }
+}
+
+int DataFlow::PickRequests(void *args_list[], BaseRequest *req_list[], int queue_wait_time_ms_list[], 
+    const int max_count) {
+    std::pair<QueueExtData, BaseRequest *> rp_list[DATA_FLOW_BATCH_SIZE];
+    auto now_time(Timer::GetSteadyClockMS());
+
+    int count = 0;
+    while (count < max_count) {
+        int n = (int) in_queue_.pick_batch(rp_list, (size_t) std::min(max_count - count, DATA_FLOW_BATCH_SIZE));
+        for (int i = 0; i < n; i++) {
+            args_list[count] = rp_list[i].first.args;
+            req_list[count] = rp_list[i].second;
+            queue_wait_time_ms_list[count] = now_time > rp_list[i].first.enqueue_time_ms ? 
+                now_time - rp_list[i].first.enqueue_time_ms : 0;
+            count++;
+        }
+
+        if (n < DATA_FLOW_BATCH_SIZE)
+            break;
+    }
+
+    return count;
+}
+
+int DataFlow::PickResponses(void *args_list[], BaseResponse *resp_list[], const int max_count) {
+    std::pair<QueueExtData, BaseResponse *> rp_list[DATA_FLOW_BATCH_SIZE];
+
+    int count = 0;
+    while (count < max_count) {
+        int n = (int) out_queue_.pick_batch(rp_list, (size_t) std::min(max_count - count, DATA_FLOW_BATCH_SIZE));
+        for (int i = 0; i < n; i++) {
+            args_list[count] = rp_list[i].first.args;
+            resp_list[count] = rp_list[i].second;
+            count++;
+        }
+
+        if (n < DATA_FLOW_BATCH_SIZE)
+            break;
+    }
+
+    return count;
+}
+
 bool DataFlow::CanPushRequest(const int max_queue_length) {
     return in_queue_.size() < (size_t) max_queue_length;
 }
@@ -101,15 +160,20 @@ bool DataFlow::CanPluckResponse() {
     return !out_queue_.empty();
 }
 
+size_t DataFlow::GetRequestQueueLength() {
+    return in_queue_.size();
+}
+
 void DataFlow::BreakOut() {
     in_queue_.break_out();
     out_queue_.break_out();
 }
 
 
-Worker::Worker(const int idx, WorkerPool *const pool, const int uthread_count, int uthread_stack_size)
+Worker::Worker(const int idx, WorkerPool *const pool, const int uthread_count, int uthread_stack_size,
+    const ThreadPlacement &placement)
     : idx_(idx), pool_(pool), uthread_count_(uthread_count),
-      uthread_stack_size_(uthread_stack_size), thread_(&Worker::Func, this) {
+      uthread_stack_size_(uthread_stack_size), placement_(placement), thread_(&Worker::Func, this) {
 
 }
 
@@ -119,6 +183,9 @@ Worker::~Worker() {
 }
 
 void Worker::Func() {
+    if (!placement_.Apply())
+        printf("worker %d of unit %d apply placement %s err\n", idx_, pool_->idx_, placement_.ToString().c_str());
+
     //如果thread_count为0，则为线程模式
     if (uthread_count_ == 0) 
         ThreadMode();
@@ -138,7 +205,7 @@ void Worker::ThreadMode() {
         if (request == nullptr) 
             continue;
 
-        WorkerLogic(args, request, queue_wait_time_ms);
+        WorkerLogic(pool_, args, request, queue_wait_time_ms);
     }
 }
 
@@ -147,40 +214,75 @@ void Worker::UThreadMode() {
     worker_scheduler_ = new UThreadEpollScheduler(uthread_stack_size_, uthread_count_, true);
     assert(worker_scheduler_ != nullptr);
     worker_scheduler_->SetHandlerNewRequestFunc(std::bind(&Worker::HandlerNewRequestFunc, this));
+    worker_scheduler_->SetHasPendingWorkFunc(std::bind(&Worker::HasPendingRequest, this));
+    worker_scheduler_->SetSleepFunc(std::bind(&Worker::SleepFunc, this, std::placeholders::_1));
     worker_scheduler_->RunForever();
 }
 
-//将WorkerLogic的包装加入调度器的任务队列
+//将WorkerLogic的包装加入调度器的任务队列，直到协程数已满或者队列为空.
+//多个请求的NotifyEpoll可能被合并成一次唤醒，所以每次都要取完.
+//按照空闲的协程数批量取出请求，本单元的队列为空时，再从其他单元的队列中偷取
 void Worker::HandlerNewRequestFunc() {
-    if (worker_scheduler_->IsTaskFull())
-        return;
+    void *args_list[DATA_FLOW_BATCH_SIZE];
+    BaseRequest *req_list[DATA_FLOW_BATCH_SIZE];
+    int queue_wait_time_ms_list[DATA_FLOW_BATCH_SIZE];
 
-    void *args = nullptr;
-    BaseRequest *request = nullptr;
-    int queue_wait_time_ms = pool_->data_flow_->PickRequest(args, request);
+    while (true) {
+        int free_count = std::min(worker_scheduler_->GetFreeTaskCount(), DATA_FLOW_BATCH_SIZE);
+        if (free_count <= 0)
+            return;
 
-    if (!request)
-        return;
-    
-    worker_scheduler_->AddTask(std::bind(&Worker::UThreadFunc, this, args, request, queue_wait_time_ms), nullptr);
+        int count = pool_->data_flow_->PickRequests(args_list, req_list, queue_wait_time_ms_list, free_count);
+        for (int i = 0; i < count; i++)
+            worker_scheduler_->AddTask(std::bind(&Worker::UThreadFunc, this, pool_, args_list[i], req_list[i], 
+                queue_wait_time_ms_list[i]), nullptr);
+
+        if (count == free_count)
+            continue;
+
+        WorkerPool *owner = pool_;
+        void *args = nullptr;
+        BaseRequest *request = nullptr;
+        int queue_wait_time_ms = pool_->StealRequest(owner, args, request);
+
+        if (!request)
+            return;
+        
+        worker_scheduler_->AddTask(std::bind(&Worker::UThreadFunc, this, owner, args, request, queue_wait_time_ms), 
+            nullptr);
+    }
 }
 
-void Worker::UThreadFunc(void *args, BaseRequest *req, int queue_wait_time_ms) {
-    WorkerLogic(args, req, queue_wait_time_ms);
+//协程数已满时留在队列中的请求，有协程结束后调度器不阻塞，马上处理
+bool Worker::HasPendingRequest() {
+    return !worker_scheduler_->IsTaskFull() && 
+        (pool_->data_flow_->CanPluckRequest() || pool_->CanStealRequest());
 }
 
-//真正处理逻辑的函数，对没有超时的请求，会分发到具体的函数处理，最后将结果push到response队列中
-void Worker::WorkerLogic(void *args, BaseRequest *req, int queue_wait_time_ms) {
+//协程数已满时即使阻塞也不能接收新的请求，不标记为空闲
+void Worker::SleepFunc(const bool sleeping) {
+    pool_->SetWorkerIdle(idx_, sleeping && !worker_scheduler_->IsTaskFull());
+}
+
+void Worker::UThreadFunc(WorkerPool *owner, void *args, BaseRequest *req, int queue_wait_time_ms) {
+    WorkerLogic(owner, args, req, queue_wait_time_ms);
+}
+
+//真正处理逻辑的函数，对没有超时的请求，会分发到具体的函数处理，最后将结果push到response队列中.
+//应答交给请求所属单元的DataFlow，并唤醒该单元的IO调度器
+void Worker::WorkerLogic(WorkerPool *owner, void *args, BaseRequest *req, int queue_wait_time_ms) {
+    StatQueueWait(queue_wait_time_ms);
+
     BaseResponse *resp = req->GenResponse();
 
     if (queue_wait_time_ms < MAX_QUEUE_WAIT_TIME_COST) {
-        DispatcherArgs_t dispatcher_args(worker_scheduler_, pool_->args_, args);
-        pool_->dispatch_(*req, resp, &dispatcher_args);
+        DispatcherArgs_t dispatcher_args(worker_scheduler_, owner->args_, MyServerIO::GetSocket(args));
+        owner->dispatch_(*req, resp, &dispatcher_args);
     }
 
-    pool_->data_flow_->PushResponse(args, resp);
+    owner->data_flow_->PushResponse(args, resp);
 
-    pool_->scheduler_->NotifyEpoll();
+    owner->scheduler_->NotifyEpoll();
 
     if (req) {
         delete req;
@@ -195,6 +297,44 @@ void Worker::NotifyEpoll() {
     worker_scheduler_->NotifyEpoll();
 }
 
+void Worker::StatQueueWait(const int queue_wait_time_ms) {
+    uint64_t now_second = Timer::GetSteadyClockMS() / 1000;
+    if (now_second != stat_second_) {
+        //先发布统计值再发布时间，读到新时间的线程一定能读到新的统计值
+        requests_per_second_ = request_count_;
+        queue_wait_max_ms_per_second_ = queue_wait_max_ms_;
+        queue_wait_avg_ms_per_second_ = request_count_ > 0 ? (int) (queue_wait_sum_ms_ / request_count_) : 0;
+        stat_published_second_ = stat_second_;
+
+        stat_second_ = now_second;
+        request_count_ = 0;
+        queue_wait_sum_ms_ = 0;
+        queue_wait_max_ms_ = 0;
+    }
+
+    request_count_++;
+    queue_wait_sum_ms_ += queue_wait_time_ms;
+    if (queue_wait_time_ms > queue_wait_max_ms_)
+        queue_wait_max_ms_ = queue_wait_time_ms;
+}
+
+//发布的统计值只有在上一秒内才有效
+bool Worker::IsStatStale() const {
+    return stat_published_second_ + 1 < Timer::GetSteadyClockMS() / 1000;
+}
+
+int Worker::GetRequestsPerSecond() const {
+    return IsStatStale() ? 0 : requests_per_second_.load();
+}
+
+int Worker::GetQueueWaitMaxMS() const {
+    return IsStatStale() ? 0 : queue_wait_max_ms_per_second_.load();
+}
+
+int Worker::GetQueueWaitAvgMS() const {
+    return IsStatStale() ? 0 : queue_wait_avg_ms_per_second_.load();
+}
+
 void Worker::Shutdown() {
     shut_down_ = true;
     pool_->data_flow_->BreakOut();
@@ -202,11 +342,21 @@ void Worker::Shutdown() {
 
 WorkerPool::WorkerPool(const int idx, UThreadEpollScheduler *const scheduler, const MyServerConfig *const config,
     const int thread_count, const int uthread_count_per_thread, const int uthread_stack_size, 
-    DataFlow *const data_flow, Dispatch_t dispatch, void *args) 
+    DataFlow *const data_flow, Dispatch_t dispatch, void *args, 
+    const std::vector<ThreadPlacement> &worker_placement_list) 
     : idx_(idx), scheduler_(scheduler), config_(config), data_flow_(data_flow), dispatch_(dispatch),
-      args_(args), last_notify_idx_(0) {
+      args_(args), last_notify_idx_(0), last_steal_notify_idx_(0) {
+    idle_mask_count_ = (thread_count + 63) / 64;
+    idle_mask_list_.reset(new std::atomic<uint64_t>[idle_mask_count_ > 0 ? idle_mask_count_ : 1]);
+    for (size_t i = 0; i < idle_mask_count_; ++i)
+        idle_mask_list_[i] = 0;
+
     for (int i = 0; i < thread_count; ++i) {
-        auto worker = new Worker(i, this, uthread_count_per_thread, uthread_stack_size);
+        ThreadPlacement placement;
+        if (i < (int) worker_placement_list.size())
+            placement = worker_placement_list[i];
+
+        auto worker = new Worker(i, this, uthread_count_per_thread, uthread_stack_size, placement);
         assert(worker != nullptr);
         worker_list_.push_back(worker);
     }
@@ -219,19 +369,125 @@ WorkerPool::~WorkerPool() {
     }
 }
 
-//采用轮询的方法来唤醒线程池中的一个工作线程
-void WorkerPool::NotifyEpoll() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (last_notify_idx_ == worker_list_.size())
-        last_notify_idx_ = 0;
+//唤醒本单元最多count个空闲的工作线程，没有空闲的工作线程时不再继续.
+//开启work stealing且队列中的请求比工作线程还多时，说明本单元的worker已经忙不过来，
+//再轮流唤醒其他单元的一个工作线程，它在自己的队列为空时会来偷取请求
+void WorkerPool::NotifyEpoll(const int count) {
+    for (int i = 0; i < count; i++) {
+        if (!NotifyWorker())
+            break;
+    }
+
+    if (!steal_enabled_ || data_flow_->GetRequestQueueLength() <= worker_list_.size())
+        return;
+
+    WorkerPool *steal_pool = steal_pool_list_[last_steal_notify_idx_++ % steal_pool_list_.size()];
+    steal_pool->NotifyWorker();
+}
+
+/* 从位图中取走一个空闲的工作线程并唤醒它，同时到达的请求会唤醒不同的工作线程.
+ * 没有空闲的工作线程时，所有工作线程都会在阻塞之前检查队列，但检查队列和标记空闲之间到达的请求
+ * 可能两边都看不到，所以仍然轮流通知一个工作线程. 它正在运行时NotifyEpoll不需要系统调用，
+ * 只会让它下一次不阻塞而是再检查一次队列.
+ * thread-per-core模式下没有工作线程 */
+bool WorkerPool::NotifyWorker() {
+    if (worker_list_.empty())
+        return false;
+
+    for (size_t i = 0; i < idle_mask_count_; i++) {
+        std::atomic<uint64_t> &idle_mask = idle_mask_list_[i];
+        uint64_t mask = idle_mask.load(std::memory_order_relaxed);
+        while (mask != 0) {
+            int bit = __builtin_ctzll(mask);
+            if (idle_mask.compare_exchange_weak(mask, mask & ~(1ULL << bit))) {
+                worker_list_[i * 64 + bit]->NotifyEpoll();
+                return true;
+            }
+        }
+    }
+
+    worker_list_[last_notify_idx_++ % worker_list_.size()]->NotifyEpoll();
+    return false;
+}
+
+void WorkerPool::SetWorkerIdle(const int worker_idx, const bool idle) {
+    std::atomic<uint64_t> &idle_mask = idle_mask_list_[worker_idx / 64];
+    uint64_t bit = 1ULL << (worker_idx % 64);
+    if (idle)
+        idle_mask.fetch_or(bit);
+    else if (idle_mask.load(std::memory_order_relaxed) & bit)
+        idle_mask.fetch_and(~bit);
+}
+
+void WorkerPool::EnableSteal(const std::vector<WorkerPool *> &steal_pool_list) {
+    if (steal_pool_list.empty())
+        return;
+
+    steal_pool_list_ = steal_pool_list;
+    steal_enabled_ = true;
+}
+
+//按照从下一个单元开始的顺序，从第一个有积压请求的单元中取一个请求
+int WorkerPool::StealRequest(WorkerPool *&owner, void *&args, BaseRequest *&req) {
+    if (!steal_enabled_)
+        return 0;
+
+    for (auto &steal_pool : steal_pool_list_) {
+        int queue_wait_time_ms = steal_pool->data_flow_->PickRequest(args, req);
+        if (req != nullptr) {
+            owner = steal_pool;
+            return queue_wait_time_ms;
+        }
+    }
+
+    return 0;
+}
+
+bool WorkerPool::CanStealRequest() {
+    if (!steal_enabled_)
+        return false;
+
+    for (auto &steal_pool : steal_pool_list_) {
+        if (steal_pool->data_flow_->CanPluckRequest())
+            return true;
+    }
+
+    return false;
+}
+
+int WorkerPool::GetRequestsPerSecond() const {
+    int requests_per_second = 0;
+    for (auto &worker : worker_list_)
+        requests_per_second += worker->GetRequestsPerSecond();
 
-    worker_list_[last_notify_idx_++]->NotifyEpoll();
+    return requests_per_second;
+}
+
+int WorkerPool::GetQueueWaitMaxMS() const {
+    int queue_wait_max_ms = 0;
+    for (auto &worker : worker_list_)
+        queue_wait_max_ms = std::max(queue_wait_max_ms, worker->GetQueueWaitMaxMS());
+
+    return queue_wait_max_ms;
+}
+
+int WorkerPool::GetQueueWaitAvgMS() const {
+    uint64_t queue_wait_sum_ms = 0;
+    uint64_t request_count = 0;
+    for (auto &worker : worker_list_) {
+        int requests_per_second = worker->GetRequestsPerSecond();
+        queue_wait_sum_ms += (uint64_t) worker->GetQueueWaitAvgMS() * requests_per_second;
+        request_count += requests_per_second;
+    }
+
+    return request_count > 0 ? (int) (queue_wait_sum_ms / request_count) : 0;
 }
 
 MyServerIO::MyServerIO(const int idx, UThreadEpollScheduler *const scheduler, const MyServerConfig *config,
-    DataFlow *data_flow, WorkerPool *worker_pool, myrpc::BaseMessageHandlerFactoryCreateFunc msg_handler_factory_create_func)
+    DataFlow *data_flow, WorkerPool *worker_pool, Dispatch_t dispatch, void *args,
+    myrpc::BaseMessageHandlerFactoryCreateFunc msg_handler_factory_create_func)
     : idx_(idx), scheduler_(scheduler), config_(config), data_flow_(data_flow), worker_pool_(worker_pool),
-      msg_handler_factory_(std::move(msg_handler_factory_create_func())) {
+      dispatch_(dispatch), args_(args), msg_handler_factory_(std::move(msg_handler_factory_create_func())) {
 
 }
 
@@ -250,6 +506,13 @@ bool MyServerIO::AddAcceptedFd(const int accepted_fd) {
     return true;
 }
 
+void MyServerIO::AddListenFd(const int listen_fd) {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    listen_fd_list_.push(listen_fd);
+
+    scheduler_->NotifyEpoll();
+}
+
 void MyServerIO::HandlerAcceptedFd() {
     std::lock_guard<std::mutex> lock(queue_mutex_);
     while (!accepted_fd_list_.empty()) {
@@ -257,121 +520,331 @@ void MyServerIO::HandlerAcceptedFd() {
         accepted_fd_list_.pop();
         scheduler_->AddTask(std::bind(&MyServerIO::IOFunc, this, accepted_fd), nullptr);
     }
+
+    while (!listen_fd_list_.empty()) {
+        int listen_fd = listen_fd_list_.front();
+        listen_fd_list_.pop();
+        scheduler_->AddTask(std::bind(&MyServerIO::AcceptFunc, this, listen_fd), nullptr);
+    }
 }
 
+//批量接受链接，每个链接创建一个IOFunc协程.
+//一批接满时先让出调度器，让新链接的协程和其他socket上的事件先得到处理
+void MyServerIO::AcceptFunc(int listen_fd) {
+    UThreadSocket_t *socket = scheduler_->CreateSocket(listen_fd, -1, -1, false);
+    int fd_list[MAX_ACCEPT_BATCH];
+
+    while (true) {
+        int count = UThreadAcceptBatch(*socket, fd_list, MAX_ACCEPT_BATCH, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (count < 0) {
+            //fd或者内存不足时，等待一段时间再接受
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                //log
+                UThreadWait(*socket, 10);
+                continue;
+            }
+
+            //log
+            break;
+        }
+
+        for (int i = 0; i < count; i++)
+            scheduler_->AddTask(std::bind(&MyServerIO::IOFunc, this, fd_list[i]), nullptr);
+
+        if (count == MAX_ACCEPT_BATCH)
+            scheduler_->DeferTask();
+    }
+
+    UThreadClose(*socket);
+    free(socket);
+}
+
+MyServerIO::PipelineConn::PipelineConn(UThreadSocket_t *const socket_value, const int depth)
+    : socket(socket_value), slot_list(depth) {
+
+}
+
+/* 没有未完成的请求时阻塞读取下一个请求.
+ * 流水线深度大于1时，如果接收缓存区中已经有完整的后续请求，在等待应答之前继续读取并压入队列，
+ * 最多同时有pipeline_depth个请求；接收缓存区中只有半个请求时先等待并发送应答，再读取剩下的数据.
+ * 应答按照请求的顺序放在PipelineConn中，最早的请求的应答回来之后，把按顺序已经回来的应答一起发送 */
 void MyServerIO::IOFunc(int accepted_fd) {
     UThreadSocket_t *socket = scheduler_->CreateSocket(accepted_fd);
     UThreadTcpStream stream;
     stream.Attach(socket);
     UThreadSetSocketTimeout(*socket, config_->GetSocketTimeoutMS());
 
-    while (true) {
-        auto msg_handler(msg_handler_factory_->Create());
-        if (!msg_handler) {
-            //log
-            break;
-        }
+    const uint64_t depth = config_->GetPipelineDepth();
+    //在ActiveSocketFunc中可能晚于本协程释放
+    PipelineConn *conn = new PipelineConn(socket, depth);
+    //读取出错或者请求不是keep alive时不再读取，发送完已经读取的请求的应答之后关闭
+    bool reading = true;
 
-        //会在worker中被删除
-        BaseRequest *req = nullptr;
-        int ret = msg_handler->RecvRequest(stream, req);
-        if (ret != 0) {
-            if (req) {
-                delete req;
-                req = nullptr;
+    while (true) {
+        uint64_t outstanding = conn->recv_seq - conn->send_seq;
+        bool read_next = reading && (outstanding == 0 ||
+                (outstanding < depth && stream.GetStreamBuf()->RecvDataSize() > 0));
+        std::unique_ptr<BaseMessageHandler> msg_handler;
+        if (read_next) {
+            msg_handler = msg_handler_factory_->Create();
+            if (!msg_handler) {
+                //log
+                reading = false;
+                continue;
             }
 
-            //log
-
-            break;
+            //阻塞在接收上时回来的应答没有办法发送，所以只有完整的请求已经在接收缓存区中时才提前读取
+            if (outstanding > 0)
+                read_next = msg_handler->RequestBuffered(stream);
         }
 
-        char client_ip[128] = {'\0'};
-        stream.GetRemoteHost(client_ip, sizeof(client_ip));
-        //log
+        if (read_next) {
+            //会在worker中被删除
+            BaseRequest *req = nullptr;
+            int ret = msg_handler->RecvRequest(stream, req);
+            if (ret != 0) {
+                if (req) {
+                    delete req;
+                    req = nullptr;
+                }
+
+                //log
 
-        if (!data_flow_->CanPushRequest(config_->GetMaxQueueLength())) {
-            if (req) {
-                delete req;
-                req = nullptr;
+                reading = false;
+                continue;
             }
 
+            char client_ip[128] = {'\0'};
+            stream.GetRemoteHost(client_ip, sizeof(client_ip));
             //log
 
-            break;
-        }
+            if (!msg_handler->keep_alive())
+                reading = false;
 
-        data_flow_->PushRequest(socket, req);
+            //配置为inline的方法直接在本协程中处理，应答和其他请求的应答一样按顺序发送，
+            //不经过DataFlow和工作线程. thread-per-core模式下所有请求都这样处理
+            if (data_flow_ == nullptr || config_->IsInlineURI(req->uri())) {
+                conn->slot(conn->recv_seq).resp = DispatchInline(socket, req);
+                conn->recv_seq++;
+                continue;
+            }
 
-        //如果工作线程工作在协程模式，则需要唤醒
-        //工作线程会删除掉request
-        worker_pool_->NotifyEpoll();
-        UThreadSetArgs(*socket, nullptr);
+            //还没有压入队列的请求也计入队列长度
+            if (!data_flow_->CanPushRequest(config_->GetMaxQueueLength() - pending_count_)) {
+                if (req) {
+                    delete req;
+                    req = nullptr;
+                }
 
-        UThreadWait(*socket, config_->GetSocketTimeoutMS());
-        if (UThreadGetArgs(*socket) == nullptr) {
-            //因为有一个输入队列，所以弹出后套接字会被关闭
-            socket = stream.DetachSocket();
-            UThreadLazyDestory(*socket);
+                //log
 
-            //log
+                reading = false;
+                continue;
+            }
 
-            break;
+            //请求先暂存起来，在本次循环的FlushRequests中一起压入队列并唤醒工作线程.
+            //暂存已满时马上压入
+            //工作线程会删除掉request
+            if (pending_count_ == DATA_FLOW_BATCH_SIZE)
+                FlushRequests();
+            PipelineSlot &slot = conn->slot(conn->recv_seq);
+            slot.conn = conn;
+            pending_args_list_[pending_count_] = &slot;
+            pending_req_list_[pending_count_] = req;
+            pending_count_++;
+            conn->recv_seq++;
+            conn->in_flight++;
+
+            continue;
         }
 
-        {
-            BaseResponse *resp = (BaseResponse *) UThreadGetArgs(*socket);
-            if (!resp->fake()) {
-                ret = resp->Send(stream);
+        if (outstanding == 0)
+            break;
+
+        if (conn->slot(conn->send_seq).resp == nullptr) {
+            conn->waiting = true;
+            UThreadWait(*socket, config_->GetSocketTimeoutMS());
+            conn->waiting = false;
+
+            if (conn->slot(conn->send_seq).resp == nullptr) {
                 //log
+                break;
             }
-            delete resp;
         }
 
-        if (!msg_handler->keep_alive() || (ret != 0)) 
+        if (SendResponses(conn, stream) != 0) 
             break;
     }
+
+    //已经回来但还没有发送的应答
+    for (uint64_t seq = conn->send_seq; seq < conn->recv_seq; seq++) {
+        PipelineSlot &slot = conn->slot(seq);
+        if (slot.resp != nullptr) {
+            delete slot.resp;
+            slot.resp = nullptr;
+        }
+    }
+
+    //因为有一个输入队列，还在队列中的请求的应答回来之后，socket才会在ActiveSocketFunc中被关闭
+    if (conn->in_flight > 0) {
+        conn->closed = true;
+        socket = stream.DetachSocket();
+        UThreadLazyDestory(*socket);
+    }
+    else {
+        delete conn;
+    }
+}
+
+int MyServerIO::SendResponses(PipelineConn *conn, UThreadTcpStream &stream) {
+    int ret = 0;
+    BaseTcpStreamBuf *buf = stream.GetStreamBuf();
+
+    //应答以关闭链接作为结束时，之后的应答不再发送
+    bool close = false;
+
+    //发送缓存区满之前只写入缓存区，最后一起flush
+    buf->SetCork(true);
+    while (conn->send_seq < conn->recv_seq) {
+        PipelineSlot &slot = conn->slot(conn->send_seq);
+        if (slot.resp == nullptr)
+            break;
+
+        if (ret == 0 && !close && !slot.resp->fake()) {
+            ret = slot.resp->Send(stream);
+            close = !slot.resp->keep_alive();
+            //log
+        }
+        delete slot.resp;
+        slot.resp = nullptr;
+        conn->send_seq++;
+    }
+    buf->SetCork(false);
+
+    if (ret == 0 && !stream.flush().good()) 
+        ret = static_cast<int>(stream.LastError());
+
+    //返回非0时IO协程关闭链接
+    if (ret == 0 && close)
+        ret = -1;
+
+    return ret;
 }
 
+UThreadSocket_t *MyServerIO::GetSocket(void *const data_flow_args) {
+    return ((PipelineSlot *) data_flow_args)->conn->socket;
+}
+
+//在IO协程中直接调用dispatch，DispatcherArgs_t中的调度器为IO调度器.
+//处理函数会阻塞本单元所有链接的IO，只适用于很快就能完成的方法.
+//处理函数可以使用的栈和工作协程相同，为WorkerUThreadStackSize，超过时碰到保护页而不是破坏其他协程的栈
+BaseResponse *MyServerIO::DispatchInline(UThreadSocket_t *socket, BaseRequest *req) {
+    BaseResponse *resp = req->GenResponse();
+
+    DispatcherArgs_t dispatcher_args(scheduler_, args_, socket);
+    dispatch_(*req, resp, &dispatcher_args);
+
+    delete req;
+
+    return resp;
+}
+
+//一次取出一批应答，全部放回各自链接的PipelineConn之后再唤醒等待的IO协程，
+//这样同一个链接在这一批中的多个应答可以一起发送. 每次调用返回一个socket，取完后再取下一批
 UThreadSocket_t *MyServerIO::ActiveSocketFunc() {
-    while (data_flow_->CanPluckResponse()) {
-        void *args = nullptr;
-        BaseResponse *resp = nullptr;
+    while (wake_idx_ == wake_count_) {
+        wake_idx_ = wake_count_ = 0;
 
-        int queue_wait_time_ms = data_flow_->PluckResponse(args, resp);
-        if (!resp)
+        int resp_count = data_flow_->PickResponses(resp_args_list_, resp_list_, DATA_FLOW_BATCH_SIZE);
+        if (resp_count == 0)
             return nullptr;
 
-        UThreadSocket_t *socket = (UThreadSocket_t *) args;
-        //套接字已经超时，关闭套接字
-        if (socket != nullptr && IsUThreadDestory(*socket)) {
-            UThreadClose(*socket);
-            free(socket);
-            delete resp;
+        for (int i = 0; i < resp_count; i++) {
+            BaseResponse *resp = resp_list_[i];
+            PipelineSlot *slot = (PipelineSlot *) resp_args_list_[i];
+            PipelineConn *conn = slot->conn;
+            conn->in_flight--;
+
+            //IO协程已经退出，最后一个应答回来时关闭套接字
+            if (conn->closed) {
+                delete resp;
+                if (conn->in_flight == 0) {
+                    UThreadClose(*conn->socket);
+                    free(conn->socket);
+                    delete conn;
+                }
 
-            continue;
-        }
+                continue;
+            }
 
-        UThreadSetArgs(*socket, (void *)resp);
+            slot->resp = resp;
 
-        return socket;
+            //只在IO协程等待的正是这个应答时唤醒，不能唤醒阻塞在接收上的协程
+            if (conn->waiting && slot == &conn->slot(conn->send_seq)) {
+                conn->waiting = false;
+                wake_socket_list_[wake_count_++] = conn->socket;
+            }
+        }
     }
 
-    return  nullptr;
+    return wake_socket_list_[wake_idx_++];
+}
+
+//如果工作线程工作在协程模式，则需要唤醒，每个请求最多唤醒一个工作线程
+void MyServerIO::FlushRequests() {
+    if (pending_count_ == 0)
+        return;
+
+    data_flow_->PushRequests(pending_args_list_, pending_req_list_, pending_count_);
+    worker_pool_->NotifyEpoll(pending_count_);
+    pending_count_ = 0;
+}
+
+//在定时器或者唤醒的处理中收到的请求，下一次循环不阻塞，马上压入队列
+bool MyServerIO::HasPendingRequest() {
+    return pending_count_ > 0;
 }
 
 void MyServerIO::RunForever() {
     scheduler_->SetHandlerAcceptedFdFunc(std::bind(&MyServerIO::HandlerAcceptedFd, this));
-    scheduler_->SetActiveSocketFunc(std::bind(&MyServerIO::ActiveSocketFunc, this));
+    //没有请求队列时，调度器不需要轮询应答和暂存的请求
+    if (data_flow_ != nullptr) {
+        scheduler_->SetActiveSocketFunc(std::bind(&MyServerIO::ActiveSocketFunc, this));
+        scheduler_->SetHandlerNewRequestFunc(std::bind(&MyServerIO::FlushRequests, this));
+        scheduler_->SetHasPendingWorkFunc(std::bind(&MyServerIO::HasPendingRequest, this));
+    }
+    scheduler_->SetBusyPollUS(config_->GetIOBusyPollUS());
+    scheduler_->SetMaxFreeStackCount(config_->GetIOMaxFreeStackCount());
+    //应答在IO线程中发送，Date等固定头部由本线程的调度器每秒刷新
+    scheduler_->SetSecondFunc(&HttpProtocol::RefreshFixedHeaders);
     scheduler_->RunForever();
 }
 
+//IO协程中会调用dispatch时，栈和工作协程的栈一样大，并且有保护页，处理函数的栈溢出不会破坏其他内存
+static bool DispatchInIO(const MyServerConfig *const config) {
+    return config->GetThreadPerCore() || config->HasInlineURI();
+}
+
+static size_t IOStackSize(const MyServerConfig *const config) {
+    size_t stack_size = config->GetIOSharedStackCount() > 0 ? 128 * 1024 : 8 * 1024;
+    if (DispatchInIO(config))
+        stack_size = std::max(stack_size, (size_t) config->GetWorkerUThreadStackSize());
+
+    return stack_size;
+}
+
 MyServerUnit::MyServerUnit(const int idx, MyServer *const my_server, int worker_thread_count,
-    int worker_uthread_count_per_thread, int worker_uthread_stack_size, Dispatch_t dispatch, void *args)
-    : my_server_(my_server), scheduler_(8 * 1024, 1000000, false), 
-      worker_pool_(idx, &scheduler_, my_server_->config_, worker_thread_count, worker_uthread_count_per_thread,
-        worker_uthread_stack_size, &data_flow_, dispatch, args),
-      my_server_io_(idx, &scheduler_, my_server_->config_, &data_flow_, &worker_pool_,
+    int worker_uthread_count_per_thread, int worker_uthread_stack_size, Dispatch_t dispatch, void *args,
+    const UnitPlacement &placement)
+    : idx_(idx), my_server_(my_server), placement_(placement), 
+      scheduler_(IOStackSize(my_server_->config_), 1000000, DispatchInIO(my_server_->config_),
+        TimerType::WHEEL, IOBackend::EPOLL, my_server_->config_->GetIOSharedStackCount()), 
+      data_flow_(my_server_->config_->GetThreadPerCore() ? nullptr : 
+        new DataFlow(my_server_->config_->GetMaxQueueLength())),
+      worker_pool_(my_server_->config_->GetThreadPerCore() ? nullptr : 
+        new WorkerPool(idx, &scheduler_, my_server_->config_, worker_thread_count, worker_uthread_count_per_thread,
+          worker_uthread_stack_size, data_flow_.get(), dispatch, args, placement_.worker_list)),
+      my_server_io_(idx, &scheduler_, my_server_->config_, data_flow_.get(), worker_pool_.get(), dispatch, args,
         my_server_->msg_handler_factory_create_func_),
       thread_(&MyServerUnit::RunFunc, this) {
 
@@ -382,6 +855,9 @@ MyServerUnit::~MyServerUnit() {
 }
 
 void MyServerUnit::RunFunc() {
+    if (!placement_.io.Apply())
+        printf("io thread of unit %d apply placement %s err\n", idx_, placement_.io.ToString().c_str());
+
     my_server_io_.RunForever();
 }
 
@@ -389,6 +865,14 @@ bool MyServerUnit::AddAcceptedFd(const int accepted_fd) {
     return my_server_io_.AddAcceptedFd(accepted_fd);
 }
 
+void MyServerUnit::AddListenFd(const int listen_fd) {
+    my_server_io_.AddListenFd(listen_fd);
+}
+
+WorkerPool *MyServerUnit::GetWorkerPool() {
+    return worker_pool_.get();
+}
+
 MyServerAcceptor::MyServerAcceptor(MyServer *my_server) : my_server_(my_server) {
 
 }
@@ -406,12 +890,9 @@ void MyServerAcceptor::LoopAccept(const char *const bind_ip, const int port) {
 
     printf("listen %s:%d ok\n", bind_ip, port);
 
-    //线程绑定CPU核，并设置线程可以使用的CPU核
-    cpu_set_t mask;
-    CPU_ZERO(&mask);
-    CPU_SET(0, &mask);
-    pid_t thread_id = 0;
-    int ret = sched_setaffinity(thread_id, sizeof(mask), &mask);
+    //接受链接的主线程只把链接轮流交给各个单元，不绑定CPU，不占用Placement::Plan分配给单元的核
+    if (my_server_->config_->GetPlacementPolicy() != PlacementPolicy::NONE)
+        printf("acceptor placement: not bound\n");
 
     while (true) {
         struct sockaddr_in addr;
@@ -431,37 +912,118 @@ void MyServerAcceptor::LoopAccept(const char *const bind_ip, const int port) {
     close(listen_fd);
 }
 
+void MyServerAcceptor::ListenReusePort(const char *const bind_ip, const int port) {
+    for (auto &my_server_unit : my_server_->server_unit_list_) {
+        int listen_fd = -1;
+        if (!BlockTcpUtils::Listen(&listen_fd, bind_ip, port, true)) {
+            printf("listen %s:%d with SO_REUSEPORT err\n", bind_ip, port);
+            exit(-1);
+        }
+
+        my_server_unit->AddListenFd(listen_fd);
+    }
+
+    printf("listen %s:%d ok, %zu SO_REUSEPORT listeners\n", bind_ip, port, my_server_->server_unit_list_.size());
+
+    //链接由各个MyServerUnit接受，主线程不再需要做任何事
+    while (true) 
+        pause();
+}
+
 MyServer::MyServer(const MyServerConfig &config, const Dispatch_t &dispatch, void *args,
     myrpc::BaseMessageHandlerFactoryCreateFunc msg_handler_factory_create_func)
     : config_(&config), msg_handler_factory_create_func_(msg_handler_factory_create_func), 
       my_server_acceptor_(this) {
     
     size_t io_count = (size_t) config.GetIOThreadCount();
-    size_t worker_thread_count = (size_t) config.GetMaxThreads();
-    assert(worker_thread_count > 0);
-    if (worker_thread_count < io_count) {
-        io_count = worker_thread_count;
+    bool thread_per_core = config.GetThreadPerCore();
+
+    //thread-per-core模式下每个核一个单元，单元中不创建工作线程，malloc的每线程arena也就是每个核私有的
+    size_t worker_thread_count = thread_per_core ? 0 : (size_t) config.GetMaxThreads();
+    if (thread_per_core) {
+        assert(io_count > 0);
+        //每个单元独占一个核，单元数超过进程允许使用的CPU数时，多出的单元会绑定到已经分配出去的核上
+        size_t cpu_count = 0;
+        for (auto &node_cpu : Placement::GetNodeCpuList())
+            cpu_count += node_cpu.second.size();
+        if (cpu_count > 0 && io_count > cpu_count) {
+            printf("thread-per-core: %zu io threads but only %zu usable cpus, clamped to %zu\n",
+                io_count, cpu_count, cpu_count);
+            io_count = cpu_count;
+        }
+    }
+    else {
+        assert(worker_thread_count > 0);
+        if (worker_thread_count < io_count) {
+            io_count = worker_thread_count;
+        }
     }
 
-    int worker_uthread_stack_size = config.GetWorkerUThreadStackSize();
+    //每个单元的工作线程数，除不尽的部分都交给最后一个单元
+    std::vector<int> worker_count_list(io_count, 0);
     size_t worker_thread_count_per_io = worker_thread_count / io_count;
     for (size_t i = 0; i < io_count; ++i) {
         if (i == io_count - 1) {
             worker_thread_count_per_io = worker_thread_count - (worker_thread_count_per_io * (io_count - 1));
         }
+        worker_count_list[i] = (int) worker_thread_count_per_io;
+    }
+
+    //thread-per-core模式下每个单元独占一个CPU
+    PlacementPolicy placement_policy = config.GetPlacementPolicy();
+    if (thread_per_core && placement_policy == PlacementPolicy::NONE)
+        placement_policy = PlacementPolicy::CPU;
+    auto placement_list(Placement::Plan(placement_policy, worker_count_list));
 
-        auto my_server_unit = new MyServerUnit(i, this, (int) worker_thread_count_per_io, 
-            config.GetWorkerUThreadCount(), worker_uthread_stack_size,
-            dispatch, args);
+    int worker_uthread_stack_size = config.GetWorkerUThreadStackSize();
+    for (size_t i = 0; i < io_count; ++i) {
+        //单元在构造时分配的调度器和队列等内存优先来自它所在的节点，
+        //线程启动后各自再设置，之后分配的协程栈也在该节点上
+        if (placement_list[i].io.node >= 0)
+            Placement::SetPreferredNode(placement_list[i].io.node);
+
+        auto my_server_unit = new MyServerUnit(i, this, worker_count_list[i], 
+            thread_per_core ? 0 : config.GetWorkerUThreadCount(), worker_uthread_stack_size,
+            dispatch, args, placement_list[i]);
 
         assert(my_server_unit != nullptr);
         server_unit_list_.push_back(my_server_unit);
     }
 
+    if (placement_policy != PlacementPolicy::NONE) {
+        Placement::SetPreferredNode(-1);
+
+        for (size_t i = 0; i < io_count; ++i) {
+            std::string worker_placement;
+            for (size_t j = 0; j < placement_list[i].worker_list.size(); ++j)
+                worker_placement += ", worker " + std::to_string(j) + " " + placement_list[i].worker_list[j].ToString();
+            printf("unit %zu placement: io %s%s\n", i, placement_list[i].io.ToString().c_str(), worker_placement.c_str());
+        }
+    }
+
+    if (thread_per_core) {
+        printf("server already started in thread-per-core mode, %zu cores\n", io_count);
+        return;
+    }
+
+    //线程模式的worker阻塞在本单元的队列上，不能被唤醒去偷取请求，只在协程模式下开启
+    bool work_stealing = config.GetWorkStealing() && config.GetWorkerUThreadCount() > 0 && io_count > 1;
+    if (work_stealing) {
+        for (size_t i = 0; i < io_count; ++i) {
+            std::vector<WorkerPool *> steal_pool_list;
+            for (size_t j = 1; j < io_count; ++j) 
+                steal_pool_list.push_back(server_unit_list_[(i + j) % io_count]->GetWorkerPool());
+            server_unit_list_[i]->GetWorkerPool()->EnableSteal(steal_pool_list);
+        }
+    }
+
     printf("server already started, %zu io threads %zu workers\n", io_count, worker_thread_count);
 
     if (config.GetWorkerUThreadCount() > 0) 
         printf("server in uthread mode, %d uthread per worker\n", config.GetWorkerUThreadCount());
+
+    if (work_stealing)
+        printf("work stealing between %zu units\n", io_count);
 }
 
 MyServer::~MyServer() {
@@ -470,7 +1032,39 @@ MyServer::~MyServer() {
 }
 
 void MyServer::RunForever() {
-    my_server_acceptor_.LoopAccept(config_->GetBindIP(), config_->GetPort());
+    if (config_->GetReusePort() || config_->GetThreadPerCore())
+        my_server_acceptor_.ListenReusePort(config_->GetBindIP(), config_->GetPort());
+    else
+        my_server_acceptor_.LoopAccept(config_->GetBindIP(), config_->GetPort());
+}
+
+//thread-per-core模式下请求不排队，没有WorkerPool，返回0
+int MyServer::GetQueueWaitMaxMS() const {
+    int queue_wait_max_ms = 0;
+    for (auto &my_server_unit : server_unit_list_) {
+        WorkerPool *worker_pool = my_server_unit->GetWorkerPool();
+        if (worker_pool != nullptr)
+            queue_wait_max_ms = std::max(queue_wait_max_ms, worker_pool->GetQueueWaitMaxMS());
+    }
+
+    return queue_wait_max_ms;
+}
+
+//和WorkerPool相同，各单元的平均值按请求数加权，空闲的单元不会拉低忙碌单元的排队时间
+int MyServer::GetQueueWaitAvgMS() const {
+    uint64_t queue_wait_sum_ms = 0;
+    uint64_t request_count = 0;
+    for (auto &my_server_unit : server_unit_list_) {
+        WorkerPool *worker_pool = my_server_unit->GetWorkerPool();
+        if (worker_pool == nullptr)
+            continue;
+
+        int requests_per_second = worker_pool->GetRequestsPerSecond();
+        queue_wait_sum_ms += (uint64_t) worker_pool->GetQueueWaitAvgMS() * requests_per_second;
+        request_count += requests_per_second;
+    }
+
+    return request_count > 0 ? (int) (queue_wait_sum_ms / request_count) : 0;
 }
 
 }
\ No newline at end of file
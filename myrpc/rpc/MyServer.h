@@ -1,7 +1,8 @@
 /* 包含整个RPC的基本结构.
  * DataFlow为数据流类，所有的请求和应答分别保存在两个线程安全的队列中.
  * Worker为工作线程类，如果是协程模式，每个Worker会有多个协程.
- * WorkerPool为工作线程池类，管理worker和调度各个工作线程.
+ * WorkerPool为工作线程池类，管理worker和调度各个工作线程，
+ * 开启work stealing时空闲的协程模式worker会处理其他单元的请求，应答仍然交给请求所属的单元.
  * MyServerUnit，独立的工作单元，每个单元有一个工作线程池，协程调度器和数据流.
  * MyServerIO，在MyServerUnit线程处理IO事件.
  * MyServer内含多个MyServerUnit工作单元.
@@ -12,6 +13,7 @@
 
 #include "../http.h"
 #include "../msg.h"
+#include "Placement.h"
 #include "ServerBase.h"
 #include "ServerConfig.h"
 #include "ThreadQueue.h"
@@ -21,7 +23,8 @@ namespace myrpc {
 
 class DataFlow final {
 public:
-    DataFlow();
+    //请求和应答队列的容量
+    DataFlow(const int max_queue_length);
     ~DataFlow();
 
     void PushRequest(void *args, BaseRequest *req);
@@ -32,12 +35,20 @@ public:
     int PluckResponse(void *&args, BaseResponse *&resp);
     int PickResponse(void *&args, BaseResponse *&resp);
 
+    //批量的版本，每DATA_FLOW_BATCH_SIZE个元素只需要一次CAS，整批只取一次时间.
+    //Pick的版本返回取出的数目，queue_wait_time_ms_list为每个请求在队列中等待的时间
+    void PushRequests(void *const args_list[], BaseRequest *const req_list[], const int count);
+    int PickRequests(void *args_list[], BaseRequest *req_list[], int queue_wait_time_ms_list[], const int max_count);
+    int PickResponses(void *args_list[], BaseResponse *resp_list[], const int max_count);
+
     bool CanPushRequest(const int max_queue_length);
     bool CanPushResponse(const int max_queue_length);
 
     bool CanPluckRequest();
     bool CanPluckResponse();
 
+    size_t GetRequestQueueLength();
+
     void BreakOut();
 
 private:
@@ -52,6 +63,11 @@ private:
             args = t_args;
         }
 
+        QueueExtData(void *t_args, const uint64_t t_enqueue_time_ms) {
+            enqueue_time_ms = t_enqueue_time_ms;
+            args = t_args;
+        }
+
         uint64_t enqueue_time_ms;
         void *args;
     };
@@ -64,13 +80,15 @@ private:
 #define QUEUE_WAIT_TIME_COST_CAL_RATE 1000
 #define MAX_QUEUE_WAIT_TIME_COST 500
 #define MAX_ACCEPT_QUEUE_LENGTH 102400
+#define MAX_ACCEPT_BATCH 64
+#define DATA_FLOW_BATCH_SIZE 64
 
 class WorkerPool;
 
 class Worker final {
 public:
     Worker(const int idx, WorkerPool *const pool, 
-        const int uthread_count, const int uthread_stack_size);
+        const int uthread_count, const int uthread_stack_size, const ThreadPlacement &placement);
     ~Worker();
 
     void Func();
@@ -83,18 +101,42 @@ public:
     void UThreadMode();
 
     void HandlerNewRequestFunc();
+    bool HasPendingRequest();
+    //调度器阻塞之前和被唤醒之后调用，更新WorkerPool中的空闲标记
+    void SleepFunc(const bool sleeping);
 
-    void UThreadFunc(void *args, BaseRequest *req, int queue_wait_time_ms);
-    void WorkerLogic(void *args, BaseRequest *req, int queue_wait_time_ms);
+    //owner为请求所属单元的WorkerPool，偷来的请求的应答要交给它
+    void UThreadFunc(WorkerPool *owner, void *args, BaseRequest *req, int queue_wait_time_ms);
+    void WorkerLogic(WorkerPool *owner, void *args, BaseRequest *req, int queue_wait_time_ms);
 
     void NotifyEpoll();
 
+    //上一秒处理的请求数，以及这些请求在队列中等待的最大和平均时间.
+    //超过一秒没有处理请求时为0
+    int GetRequestsPerSecond() const;
+    int GetQueueWaitMaxMS() const;
+    int GetQueueWaitAvgMS() const;
+
 private:
+    //在工作线程中统计每个请求的排队时间，每过一秒发布一次
+    void StatQueueWait(const int queue_wait_time_ms);
+    bool IsStatStale() const;
+
     int idx_ = -1;
     WorkerPool *pool_ = nullptr;
     int uthread_count_;
     int uthread_stack_size_;
+    //在工作线程开始时应用，协程栈在这之后分配
+    ThreadPlacement placement_;
     bool shut_down_ = false;
+    uint64_t stat_second_{0};
+    int request_count_{0};
+    uint64_t queue_wait_sum_ms_{0};
+    int queue_wait_max_ms_{0};
+    std::atomic<uint64_t> stat_published_second_{0};
+    std::atomic_int requests_per_second_{0};
+    std::atomic_int queue_wait_max_ms_per_second_{0};
+    std::atomic_int queue_wait_avg_ms_per_second_{0};
     UThreadEpollScheduler *worker_scheduler_ = nullptr;
     std::thread thread_;
 };
@@ -105,13 +147,32 @@ class WorkerPool final {
 public:
     WorkerPool (const int idx, UThreadEpollScheduler *const scheduler, const MyServerConfig *const config, 
         const int uthread_count, const int uthread_count_per_thread, const int uthread_stack_size, 
-        DataFlow *const data_flow, Dispatch_t dispatch, void *args);
+        DataFlow *const data_flow, Dispatch_t dispatch, void *args, 
+        const std::vector<ThreadPlacement> &worker_placement_list);
     ~WorkerPool();
 
-    void NotifyEpoll();
+    //唤醒最多count个空闲的工作线程，本单元的请求积压时再唤醒其他单元的一个工作线程来偷取请求
+    void NotifyEpoll(const int count = 1);
+
+    //开启work stealing，steal_pool_list为其他单元的WorkerPool
+    void EnableSteal(const std::vector<WorkerPool *> &steal_pool_list);
+    //从其他单元的DataFlow中取一个请求，owner为请求所属的WorkerPool，没有时req为nullptr
+    int StealRequest(WorkerPool *&owner, void *&args, BaseRequest *&req);
+    bool CanStealRequest();
+
+    //所有工作线程上一秒处理的请求数和排队时间统计，平均值按请求数加权
+    int GetRequestsPerSecond() const;
+    int GetQueueWaitMaxMS() const;
+    int GetQueueWaitAvgMS() const;
 
 private:
     friend class Worker;
+    friend class MyServerIO;
+
+    //唤醒一个空闲的工作线程，没有空闲的工作线程时返回false
+    bool NotifyWorker();
+    void SetWorkerIdle(const int worker_idx, const bool idle);
+
     int idx_ = -1;
     UThreadEpollScheduler *scheduler_ = nullptr;
     const MyServerConfig *config_ = nullptr;
@@ -119,31 +180,97 @@ private:
     Dispatch_t dispatch_;
     void *args_ = nullptr;
     std::vector<Worker *> worker_list_;
-    size_t last_notify_idx_;
-    std::mutex mutex_;
+    //空闲的工作线程的位图，第i位对应worker_list_[i]，在创建工作线程之前分配
+    std::unique_ptr<std::atomic<uint64_t>[]> idle_mask_list_;
+    size_t idle_mask_count_;
+    std::atomic<size_t> last_notify_idx_;
+    //按照从下一个单元开始的顺序排列，在steal_enabled_设置之前写入，之后只读
+    std::vector<WorkerPool *> steal_pool_list_;
+    std::atomic_bool steal_enabled_{false};
+    std::atomic<size_t> last_steal_notify_idx_;
 };
 
 class MyServerIO final {
 public:
+    //thread-per-core模式下没有DataFlow和WorkerPool，data_flow和worker_pool为nullptr
     MyServerIO (const int idx, UThreadEpollScheduler *const scheduler, const MyServerConfig *config,
-        DataFlow *data_flow, WorkerPool *worker_pool, myrpc::BaseMessageHandlerFactoryCreateFunc msg_handler_factory_create_func);
+        DataFlow *data_flow, WorkerPool *worker_pool, Dispatch_t dispatch, void *args,
+        myrpc::BaseMessageHandlerFactoryCreateFunc msg_handler_factory_create_func);
     ~MyServerIO();
 
     void RunForever();
     bool AddAcceptedFd(const int accepted_fd);
+    //SO_REUSEPORT模式下，由本单元的调度器在listen_fd上接受链接
+    void AddListenFd(const int listen_fd);
     void HandlerAcceptedFd();
+    void AcceptFunc(int listen_fd);
     void IOFunc(int accept_fd);
     UThreadSocket_t *ActiveSocketFunc();
+    //处理inline的请求，返回应答，req会被删除
+    BaseResponse *DispatchInline(UThreadSocket_t *socket, BaseRequest *req);
+    //把一次循环中收到的请求一起压入队列，再唤醒工作线程
+    void FlushRequests();
+    bool HasPendingRequest();
+
+    //从压入DataFlow的args中取出请求所在的链接，工作线程交给dispatch的data_flow_args和inline的请求一样为socket
+    static UThreadSocket_t *GetSocket(void *const data_flow_args);
 
 private:
+    struct PipelineConn;
+
+    //一个流水线请求的位置，压入DataFlow时作为args，应答由ActiveSocketFunc放回这里
+    struct PipelineSlot {
+        PipelineConn *conn = nullptr;
+        BaseResponse *resp = nullptr;
+    };
+
+    //一个链接上已经读取但还没有发送应答的请求，按照读取的顺序放在环形的slot_list中
+    struct PipelineConn {
+        PipelineConn(UThreadSocket_t *const socket_value, const int depth);
+
+        PipelineSlot &slot(const uint64_t seq) {
+            return slot_list[seq % slot_list.size()];
+        }
+
+        UThreadSocket_t *socket = nullptr;
+        std::vector<PipelineSlot> slot_list;
+        //已经读取的请求数和已经发送的应答数
+        uint64_t recv_seq = 0;
+        uint64_t send_seq = 0;
+        //已经压入队列但应答还没有回来的请求数
+        int in_flight = 0;
+        //IO协程正在等待最早的请求的应答
+        bool waiting = false;
+        //IO协程已经退出，最后一个应答回来时关闭socket并释放
+        bool closed = false;
+    };
+
+    //按照请求的顺序把已经回来的应答一起发送，遇到还没有回来的应答时停止
+    int SendResponses(PipelineConn *conn, UThreadTcpStream &stream);
+
     int idx_ = -1;
     UThreadEpollScheduler *scheduler_ = nullptr;
     const MyServerConfig *config_ = nullptr;
     DataFlow *data_flow_ = nullptr;
     WorkerPool *worker_pool_ = nullptr;
+    //inline的请求直接调用
+    Dispatch_t dispatch_;
+    void *args_ = nullptr;
     std::unique_ptr<BaseMessageHandlerFactory> msg_handler_factory_;
     std::queue<int> accepted_fd_list_;
+    std::queue<int> listen_fd_list_;
     std::mutex queue_mutex_;
+    //还没有压入队列的请求，只在本单元的调度器线程中访问
+    void *pending_args_list_[DATA_FLOW_BATCH_SIZE];
+    BaseRequest *pending_req_list_[DATA_FLOW_BATCH_SIZE];
+    int pending_count_ = 0;
+    //批量取出的应答
+    void *resp_args_list_[DATA_FLOW_BATCH_SIZE];
+    BaseResponse *resp_list_[DATA_FLOW_BATCH_SIZE];
+    //一批应答都放回PipelineConn之后需要唤醒的IO协程，ActiveSocketFunc每次返回其中一个socket
+    UThreadSocket_t *wake_socket_list_[DATA_FLOW_BATCH_SIZE];
+    int wake_count_ = 0;
+    int wake_idx_ = 0;
 };
 
 class MyServer;
@@ -151,17 +278,24 @@ class MyServer;
 class MyServerUnit {
 public:
     MyServerUnit(const int idx, MyServer *const my_server, int worker_thread_thread_count,
-        int worker_uthread_count_per_thread, int worker_uthread_stack_size, Dispatch_t dispatch, void *args);
+        int worker_uthread_count_per_thread, int worker_uthread_stack_size, Dispatch_t dispatch, void *args,
+        const UnitPlacement &placement);
     virtual ~MyServerUnit();
 
     void RunFunc();
     bool AddAcceptedFd(const int accepted_fd);
+    void AddListenFd(const int listen_fd);
+    //thread-per-core模式下返回nullptr
+    WorkerPool *GetWorkerPool();
 
 private:
+    int idx_ = -1;
     MyServer *my_server_ = nullptr;
+    UnitPlacement placement_;
     UThreadEpollScheduler scheduler_;
-    DataFlow data_flow_;
-    WorkerPool worker_pool_;
+    //thread-per-core模式下所有请求都在IO协程中处理，不创建请求队列和工作线程
+    std::unique_ptr<DataFlow> data_flow_;
+    std::unique_ptr<WorkerPool> worker_pool_;
     MyServerIO my_server_io_;
     std::thread thread_;
 };
@@ -172,6 +306,8 @@ public:
     ~MyServerAcceptor();
 
     void LoopAccept(const char *const bind_ip, const int port);
+    //每个MyServerUnit一个SO_REUSEPORT的监听socket，由各自的调度器接受链接
+    void ListenReusePort(const char *const bind_ip, const int port);
 
 private:
     MyServer *my_server_ = nullptr;
@@ -188,6 +324,10 @@ public:
 
     void RunForever();
 
+    //所有单元的工作线程上一秒的请求排队时间，可以在其他线程中调用
+    int GetQueueWaitMaxMS() const;
+    int GetQueueWaitAvgMS() const;
+
 private:
     friend class MyServerAcceptor;
     friend class MyServerUnit;
@@ -196,8 +336,6 @@ private:
     myrpc::BaseMessageHandlerFactoryCreateFunc msg_handler_factory_create_func_;
     MyServerAcceptor my_server_acceptor_;
     std::vector<MyServerUnit *> server_unit_list_;
-    
-    void LoopReadCrossUnitResponse();
 };
 
 }
\ No newline at end of file
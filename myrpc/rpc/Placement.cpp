@@ -0,0 +1,202 @@
+/* 按照MyServerConfig中的放置策略，为每个单元的IO线程和工作线程选择CPU和NUMA节点.
+ * NUMA拓扑从/sys/devices/system/node中读取，只使用进程当前允许运行的CPU，
+ * 读取失败时认为所有允许的CPU都在节点0上.
+ * 内存策略直接通过set_mempolicy系统调用设置，不依赖libnuma.
+ * */
+
+#include "Placement.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace myrpc {
+
+bool ThreadPlacement::Apply() const {
+    bool ok = true;
+
+    if (!cpu_list.empty()) {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        for (auto &cpu : cpu_list)
+            CPU_SET(cpu, &mask);
+        if (sched_setaffinity(0, sizeof(mask), &mask) != 0)
+            ok = false;
+    }
+
+    if (node >= 0 && !Placement::SetPreferredNode(node))
+        ok = false;
+
+    return ok;
+}
+
+//连续的CPU合并成一段
+std::string ThreadPlacement::ToString() const {
+    std::string str;
+    if (node >= 0)
+        str = "node " + std::to_string(node) + " ";
+
+    if (cpu_list.empty())
+        return str + "cpu any";
+
+    str += "cpu ";
+    for (size_t i = 0; i < cpu_list.size(); ) {
+        size_t j = i;
+        while (j + 1 < cpu_list.size() && cpu_list[j + 1] == cpu_list[j] + 1)
+            j++;
+
+        if (i > 0)
+            str += ",";
+        str += std::to_string(cpu_list[i]);
+        if (j > i)
+            str += "-" + std::to_string(cpu_list[j]);
+        i = j + 1;
+    }
+
+    return str;
+}
+
+/* 单元轮流分配到各个节点上.
+ * NUMA策略下单元的所有线程绑定到节点的全部CPU，由内核在节点内调度；
+ * CPU策略下每个线程绑定一个CPU，从所在节点的CPU中依次选取，CPU不够时从头开始 */
+std::vector<UnitPlacement> Placement::Plan(const PlacementPolicy policy, const std::vector<int> &worker_count_list) {
+    std::vector<UnitPlacement> unit_list(worker_count_list.size());
+    if (policy == PlacementPolicy::NONE)
+        return unit_list;
+
+    auto node_cpu_list(GetNodeCpuList());
+    if (node_cpu_list.empty())
+        return unit_list;
+
+    std::vector<size_t> next_cpu_idx_list(node_cpu_list.size(), 0);
+    auto next_thread = [&](const size_t node_idx) {
+        ThreadPlacement thread;
+        thread.node = node_cpu_list[node_idx].first;
+
+        const std::vector<int> &cpu_list = node_cpu_list[node_idx].second;
+        if (policy == PlacementPolicy::NUMA) {
+            thread.cpu_list = cpu_list;
+        }
+        else {
+            size_t &next_cpu_idx = next_cpu_idx_list[node_idx];
+            thread.cpu_list.push_back(cpu_list[next_cpu_idx++ % cpu_list.size()]);
+        }
+
+        return thread;
+    };
+
+    for (size_t i = 0; i < unit_list.size(); i++) {
+        size_t node_idx = i % node_cpu_list.size();
+        unit_list[i].io = next_thread(node_idx);
+        for (int j = 0; j < worker_count_list[i]; j++)
+            unit_list[i].worker_list.push_back(next_thread(node_idx));
+    }
+
+    return unit_list;
+}
+
+bool Placement::SetPreferredNode(const int node) {
+    if (node < 0)
+        return syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0) == 0;
+
+    unsigned long node_mask[16] = {0};
+    const int bits_per_long = 8 * sizeof(unsigned long);
+    if (node >= (int) sizeof(node_mask) * 8)
+        return false;
+
+    node_mask[node / bits_per_long] |= 1UL << (node % bits_per_long);
+    //内核只使用maxnode - 1位
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, node_mask, sizeof(node_mask) * 8 + 1) == 0;
+}
+
+std::vector<std::pair<int, std::vector<int>>> Placement::GetNodeCpuList() {
+    std::vector<std::pair<int, std::vector<int>>> node_cpu_list;
+
+    cpu_set_t allowed_mask;
+    CPU_ZERO(&allowed_mask);
+    if (sched_getaffinity(0, sizeof(allowed_mask), &allowed_mask) != 0)
+        return node_cpu_list;
+
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir != nullptr) {
+        struct dirent *entry = nullptr;
+        while ((entry = readdir(dir)) != nullptr) {
+            int node = -1;
+            if (sscanf(entry->d_name, "node%d", &node) != 1 || node < 0)
+                continue;
+
+            char path[128] = {'\0'};
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            FILE *fp = fopen(path, "r");
+            if (fp == nullptr)
+                continue;
+
+            char buf[4096] = {'\0'};
+            if (fgets(buf, sizeof(buf), fp) == nullptr)
+                buf[0] = '\0';
+            fclose(fp);
+
+            std::vector<int> cpu_list;
+            for (auto &cpu : ParseCpuList(buf)) {
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed_mask))
+                    cpu_list.push_back(cpu);
+            }
+
+            if (!cpu_list.empty())
+                node_cpu_list.push_back(std::make_pair(node, cpu_list));
+        }
+        closedir(dir);
+    }
+
+    //没有NUMA信息时所有允许的CPU都属于节点0
+    if (node_cpu_list.empty()) {
+        std::vector<int> cpu_list;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed_mask))
+                cpu_list.push_back(cpu);
+        }
+
+        if (!cpu_list.empty())
+            node_cpu_list.push_back(std::make_pair(0, cpu_list));
+    }
+
+    std::sort(node_cpu_list.begin(), node_cpu_list.end());
+
+    return node_cpu_list;
+}
+
+std::vector<int> Placement::ParseCpuList(const char *cpu_list) {
+    std::vector<int> result;
+
+    const char *p = cpu_list;
+    while (*p != '\0') {
+        char *end = nullptr;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+            break;
+
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1)
+                break;
+            p = end;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++)
+            result.push_back((int) cpu);
+
+        if (*p != ',')
+            break;
+        p++;
+    }
+
+    return result;
+}
+
+}
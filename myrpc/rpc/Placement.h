@@ -0,0 +1,49 @@
+/* 按照MyServerConfig中的放置策略，为每个单元的IO线程和工作线程选择CPU和NUMA节点.
+ * NUMA拓扑从/sys/devices/system/node中读取，只使用进程当前允许运行的CPU，
+ * 读取失败时认为所有允许的CPU都在节点0上.
+ * 内存策略直接通过set_mempolicy系统调用设置，不依赖libnuma.
+ * */
+
+#pragma once
+
+#include "ServerConfig.h"
+#include <sched.h>
+#include <string>
+#include <vector>
+
+namespace myrpc {
+
+//一个线程的放置，node为-1时不设置内存策略，cpu_list为空时不绑定CPU
+struct ThreadPlacement {
+    int node = -1;
+    std::vector<int> cpu_list;
+
+    //在当前线程中绑定CPU并设置内存优先从node分配，失败时返回false
+    bool Apply() const;
+    //形如"node 0 cpu 0-3,8"
+    std::string ToString() const;
+};
+
+//一个单元的放置，IO线程和它的工作线程在同一个节点上
+struct UnitPlacement {
+    ThreadPlacement io;
+    std::vector<ThreadPlacement> worker_list;
+};
+
+class Placement {
+public:
+    //worker_count_list为每个单元的工作线程数，返回每个单元的放置
+    static std::vector<UnitPlacement> Plan(const PlacementPolicy policy, const std::vector<int> &worker_count_list);
+
+    //设置当前线程的内存策略，之后新分配的页优先来自node，node为-1时恢复默认策略
+    static bool SetPreferredNode(const int node);
+
+    //每个节点上进程允许使用的CPU，不包含没有可用CPU的节点
+    static std::vector<std::pair<int, std::vector<int>>> GetNodeCpuList();
+
+private:
+    //解析"0-3,8-11"格式的CPU列表
+    static std::vector<int> ParseCpuList(const char *cpu_list);
+};
+
+}
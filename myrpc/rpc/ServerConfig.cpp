@@ -1,6 +1,7 @@
 /* 用于配置服务器的各项配置 */
 
 #include "ServerConfig.h"
+#include <algorithm>
 #include <cstring>
 #include <stdio.h>
 
@@ -69,7 +70,9 @@ const char *ServerConfig::GetPackageName() const {
 
 MyServerConfig::MyServerConfig()
     : max_connections_(800000), max_queue_length_(20480), io_thread_count_(3),
-      worker_uthread_count_(0), worker_uthread_stack_size_(64 * 1024) {
+      worker_uthread_count_(0), worker_uthread_stack_size_(64 * 1024), io_shared_stack_count_(0),
+      io_busy_poll_us_(0), io_max_free_stack_count_(1024), reuse_port_(false), work_stealing_(false), thread_per_core_(false),
+      placement_policy_(PlacementPolicy::NONE), pipeline_depth_(1) {
 
 }
 
@@ -117,4 +120,103 @@ int MyServerConfig::GetWorkerUThreadStackSize() const {
     return worker_uthread_stack_size_;
 }
 
+void MyServerConfig::SetIOSharedStackCount(const int io_shared_stack_count) {
+    io_shared_stack_count_ = io_shared_stack_count;
+}
+
+int MyServerConfig::GetIOSharedStackCount() const {
+    return io_shared_stack_count_;
+}
+
+void MyServerConfig::SetIOBusyPollUS(const int io_busy_poll_us) {
+    io_busy_poll_us_ = io_busy_poll_us;
+}
+
+int MyServerConfig::GetIOBusyPollUS() const {
+    return io_busy_poll_us_;
+}
+
+void MyServerConfig::SetIOMaxFreeStackCount(const int io_max_free_stack_count) {
+    io_max_free_stack_count_ = io_max_free_stack_count;
+}
+
+int MyServerConfig::GetIOMaxFreeStackCount() const {
+    return io_max_free_stack_count_;
+}
+
+void MyServerConfig::SetReusePort(const bool reuse_port) {
+    reuse_port_ = reuse_port;
+}
+
+bool MyServerConfig::GetReusePort() const {
+    return reuse_port_;
+}
+
+void MyServerConfig::SetWorkStealing(const bool work_stealing) {
+    work_stealing_ = work_stealing;
+}
+
+bool MyServerConfig::GetWorkStealing() const {
+    return work_stealing_;
+}
+
+void MyServerConfig::SetThreadPerCore(const bool thread_per_core) {
+    thread_per_core_ = thread_per_core;
+}
+
+bool MyServerConfig::GetThreadPerCore() const {
+    return thread_per_core_;
+}
+
+void MyServerConfig::SetPlacementPolicy(const PlacementPolicy placement_policy) {
+    placement_policy_ = placement_policy;
+}
+
+PlacementPolicy MyServerConfig::GetPlacementPolicy() const {
+    return placement_policy_;
+}
+
+void MyServerConfig::AddInlineURI(const char *uri) {
+    auto iter = std::lower_bound(inline_uri_list_.begin(), inline_uri_list_.end(), uri);
+    if (iter == inline_uri_list_.end() || *iter != uri)
+        inline_uri_list_.insert(iter, uri);
+}
+
+//uri中'?'之前的路径，只记录位置和长度
+struct InlineURIKey {
+    const char *data;
+    size_t length;
+};
+
+//和std::string的比较顺序相同
+static bool operator<(const std::string &inline_uri, const InlineURIKey &key) {
+    int ret = memcmp(inline_uri.data(), key.data, std::min(inline_uri.size(), key.length));
+    return ret < 0 || (ret == 0 && inline_uri.size() < key.length);
+}
+
+//每个请求都会在IO协程中调用，不分配内存
+bool MyServerConfig::IsInlineURI(const char *uri) const {
+    if (inline_uri_list_.empty() || uri == nullptr)
+        return false;
+
+    const char *query = strchr(uri, '?');
+    InlineURIKey key{uri, query != nullptr ? (size_t) (query - uri) : strlen(uri)};
+
+    auto iter = std::lower_bound(inline_uri_list_.begin(), inline_uri_list_.end(), key);
+    return iter != inline_uri_list_.end() && iter->size() == key.length && 
+        memcmp(iter->data(), key.data, key.length) == 0;
+}
+
+bool MyServerConfig::HasInlineURI() const {
+    return !inline_uri_list_.empty();
+}
+
+void MyServerConfig::SetPipelineDepth(const int pipeline_depth) {
+    pipeline_depth_ = pipeline_depth > 1 ? pipeline_depth : 1;
+}
+
+int MyServerConfig::GetPipelineDepth() const {
+    return pipeline_depth_;
+}
+
 }
\ No newline at end of file
@@ -2,8 +2,21 @@
 
 #pragma once 
 
+#include <string>
+#include <vector>
+
 namespace myrpc {
 
+//单元的IO线程和工作线程的放置策略
+enum class PlacementPolicy {
+    //不绑定CPU，thread-per-core模式下按照CPU策略绑定
+    NONE = 0,
+    //单元的所有线程绑定到同一个NUMA节点的全部CPU上，内存优先从该节点分配
+    NUMA,
+    //每个线程绑定一个CPU，同一个单元的线程在同一个NUMA节点上
+    CPU,
+};
+
 class ServerConfig {
 public:
     ServerConfig();
@@ -74,6 +87,51 @@ public:
     void SetWorkerUThreadStackSize(const int worker_uthread_stack_size);
     int GetWorkerUThreadStackSize() const;
 
+    //大于0时IO线程的协程使用共享栈，用于大量空闲长连接的场景
+    void SetIOSharedStackCount(const int io_shared_stack_count);
+    int GetIOSharedStackCount() const;
+
+    //大于0时IO线程在最近一次有事件之后的这段时间内忙轮询，单位为微秒
+    void SetIOBusyPollUS(const int io_busy_poll_us);
+    int GetIOBusyPollUS() const;
+
+    //每个IO线程的栈池最多保留的空闲栈数，链接高峰过后多出的栈连同保护页一起munmap
+    void SetIOMaxFreeStackCount(const int io_max_free_stack_count);
+    int GetIOMaxFreeStackCount() const;
+
+    //为true时每个IO线程使用SO_REUSEPORT各自监听端口并接受链接，不再使用单独的accept线程
+    void SetReusePort(const bool reuse_port);
+    bool GetReusePort() const;
+
+    //为true时协程模式的worker空闲时会处理其他单元积压的请求
+    void SetWorkStealing(const bool work_stealing);
+    bool GetWorkStealing() const;
+
+    /* 为true时使用thread-per-core模式，每个核一个绑定了CPU的单元，IO线程数即为核数，
+     * 超过进程允许使用的CPU数时减少到CPU数，并在启动时打印.
+     * PlacementPolicy为NONE时按照CPU策略绑定，设置为NUMA时单元绑定到节点上的所有CPU.
+     * 每个单元用SO_REUSEPORT接受链接，所有请求都在IO线程的协程中处理，
+     * 不创建工作线程，也不经过请求队列. IO协程的栈和WorkerUThreadStackSize一样大，并且有保护页 */
+    void SetThreadPerCore(const bool thread_per_core);
+    bool GetThreadPerCore() const;
+
+    //单元按顺序轮流分配到各个NUMA节点上，实际的放置在启动时打印.
+    //thread-per-core模式下NONE会被当作CPU，见SetThreadPerCore
+    void SetPlacementPolicy(const PlacementPolicy placement_policy);
+    PlacementPolicy GetPlacementPolicy() const;
+
+    //这些uri的请求在IO线程的协程中直接处理，不经过请求队列和工作线程.
+    //只用于不会阻塞而且很快完成的方法，比较时忽略uri中'?'之后的参数.
+    //有inline的uri时，IO协程的栈和WorkerUThreadStackSize一样大，并且有保护页
+    void AddInlineURI(const char *uri);
+    bool IsInlineURI(const char *uri) const;
+    bool HasInlineURI() const;
+
+    /* 每个链接上最多同时处理的流水线请求数，默认为1，即收到应答之后才读取下一个请求.
+     * 大于1时IO协程会先读取已经到达的后续请求并压入队列，应答按照请求的顺序一起发送 */
+    void SetPipelineDepth(const int pipeline_depth);
+    int GetPipelineDepth() const;
+
 private:
     int max_connections_;
     int max_queue_length_;
@@ -82,6 +140,16 @@ private:
     int io_thread_count_;
     int worker_uthread_count_;
     int worker_uthread_stack_size_;
+    int io_shared_stack_count_;
+    int io_busy_poll_us_;
+    int io_max_free_stack_count_;
+    bool reuse_port_;
+    bool work_stealing_;
+    bool thread_per_core_;
+    PlacementPolicy placement_policy_;
+    //排好序，IsInlineURI用二分查找直接比较uri中的路径，不需要构造string
+    std::vector<std::string> inline_uri_list_;
+    int pipeline_depth_;
 };
 
 }
\ No newline at end of file
@@ -1,82 +1,293 @@
-/* 线程间请求队列和响应队列的基本结构，以标准库的queue作为
- * 底层的数据结构，用mutex和condition_variable实现线程间的
- * 同步机制 */
+/* 线程间请求队列和响应队列的基本结构，是一个有界的无锁多生产者多消费者环形队列.
+ * 每个槽位有一个序号，生产者和消费者分别用CAS推进入队和出队的位置，
+ * 通过比较槽位的序号和位置判断槽位是否可写或可读，不需要加锁.
+ * 入队位置、出队位置和睡眠标记之间用填充字节隔开，避免生产者和消费者之间的伪共享.
+ * 线程模式的worker使用阻塞的pluck，先自旋一段时间，仍然没有数据时才在futex上等待.
+ * 批量的push和pick用一次CAS占用连续的多个槽位. */
 
 #pragma once
 
-#include <queue>
-#include <mutex>
-#include <condition_variable>
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace myrpc {
 
+#define THREAD_QUEUE_CACHE_LINE_SIZE 64
+#define THREAD_QUEUE_SPIN_COUNT 128
+
 template <class T>
 class ThreadQueue {
 public:
-    ThreadQueue() : break_out_(false), size_(0) { }
+    //容量向上取整为2的幂
+    ThreadQueue(const size_t capacity = 1024) : break_out_(false) {
+        capacity_ = 2;
+        while (capacity_ < capacity)
+            capacity_ <<= 1;
+        mask_ = capacity_ - 1;
+
+        cell_list_.reset(new Cell[capacity_]);
+        for (size_t i = 0; i < capacity_; i++)
+            cell_list_[i].sequence.store(i, std::memory_order_relaxed);
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_.store(0, std::memory_order_relaxed);
+    }
+
     ~ThreadQueue() {
         break_out();
     }
 
+    ThreadQueue(const ThreadQueue &) = delete;
+    ThreadQueue &operator=(const ThreadQueue &) = delete;
+
+    //近似值，其他线程同时入队或出队时可能不准确
     size_t size() {
-        return static_cast<size_t> (size_);
+        size_t dequeue_pos = dequeue_pos_.load(std::memory_order_relaxed);
+        size_t enqueue_pos = enqueue_pos_.load(std::memory_order_relaxed);
+        return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
     }
 
     bool empty() {
-        return static_cast<size_t>(size_) == 0;
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return capacity_;
     }
 
-    //压入数据，并提醒有新的数据被压入
+    //压入数据，队列已满时返回false
+    bool try_push(const T &value) {
+        if (!enqueue(value))
+            return false;
+
+        WakeUp();
+        return true;
+    }
+
+    //压入数据，并提醒有新的数据被压入. 队列已满时让出CPU直到有空位
     void push(const T &value) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        queue_.push(value);
-        size_++;
-        cv_.notify_one();
+        while (!enqueue(value))
+            std::this_thread::yield();
+
+        WakeUp();
+    }
+
+    //压入count个数据，只在最后唤醒一次消费者. 队列已满时让出CPU直到有空位
+    void push_batch(const T *value_list, const size_t count) {
+        size_t pushed = 0;
+        while (pushed < count) {
+            size_t n = enqueue_batch(value_list + pushed, count - pushed);
+            if (n == 0)
+                std::this_thread::yield();
+            pushed += n;
+        }
+
+        WakeUp();
     }
 
-    //提取数据，当队列为空时，会等待直到由数据为止
+    //提取数据，当队列为空时，会先自旋，再在futex上等待直到有数据为止
     bool pluck(T &value) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (break_out_) 
-            return false;
-        while (queu_.empty()) {
-            cv_.wait(lock);
-            if (break_out_)
+        for (int i = 0; i < THREAD_QUEUE_SPIN_COUNT; i++) {
+            if (break_out_.load(std::memory_order_acquire))
                 return false;
+            if (dequeue(value))
+                return true;
+            CpuRelax();
         }
 
-        size_--;
-        value = queue_.front();
-        queue_.pop();
-        return  true;
+        while (true) {
+            if (break_out_.load(std::memory_order_acquire))
+                return false;
+
+            //先标记有消费者要睡眠再检查队列，之后的push一定能看到标记并唤醒，
+            //push清除了标记时futex_wait会直接返回
+            sleeping_.exchange(1, std::memory_order_seq_cst);
+            if (dequeue(value))
+                return true;
+
+            if (!break_out_.load(std::memory_order_acquire))
+                FutexWait(1);
+        }
     }
 
+    //提取数据，队列为空时直接返回false
     bool pick(T &value) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (queue_.empty()) {
-            return  false;
-        }
+        return dequeue(value);
+    }
 
-        size_--;
-        value = queue_.front();
-        queue_.pop();
-        return true;    
+    //提取最多max_count个数据，返回提取的数目
+    size_t pick_batch(T *value_list, const size_t max_count) {
+        return dequeue_batch(value_list, max_count);
     }
 
     void break_out() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        break_out_ = true;
+        break_out_.store(true, std::memory_order_release);
         //析构时唤醒所有等待的线程
-        cv_.notify_all();
+        sleeping_.store(0, std::memory_order_seq_cst);
+        FutexWake(INT_MAX);
     }
 
 private:
-    std::mutex mutex_;
-    std::condition_variable cv_;
-    std::queue<T> queue_;
-    bool break_out_;
-    std::atomic_int size_;
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    //槽位的序号等于入队位置时可写，写入后序号加1，等于出队位置加1时可读，读取后序号加上容量
+    bool enqueue(const T &value) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell *cell = &cell_list_[pos & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell->data = value;
+                    cell->sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            //槽位还没有被消费者读取，队列已满
+            else if (diff < 0)
+                return false;
+            else
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool dequeue(T &value) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell *cell = &cell_list_[pos & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t) sequence - (intptr_t) (pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell->data);
+                    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            //槽位还没有被生产者写入，队列为空
+            else if (diff < 0)
+                return false;
+            else
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    //从入队位置开始连续可写的槽位，用一次CAS全部占用
+    size_t enqueue_batch(const T *value_list, const size_t count) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            size_t n = 0;
+            while (n < count && n <= mask_) {
+                Cell *cell = &cell_list_[(pos + n) & mask_];
+                if (cell->sequence.load(std::memory_order_acquire) != pos + n)
+                    break;
+                n++;
+            }
+
+            if (n == 0) {
+                Cell *cell = &cell_list_[pos & mask_];
+                intptr_t diff = (intptr_t) cell->sequence.load(std::memory_order_acquire) - (intptr_t) pos;
+                if (diff < 0)
+                    return 0;
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                for (size_t i = 0; i < n; i++) {
+                    Cell *cell = &cell_list_[(pos + i) & mask_];
+                    cell->data = value_list[i];
+                    cell->sequence.store(pos + i + 1, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    //从出队位置开始连续可读的槽位，用一次CAS全部占用
+    size_t dequeue_batch(T *value_list, const size_t max_count) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            size_t n = 0;
+            while (n < max_count && n <= mask_) {
+                Cell *cell = &cell_list_[(pos + n) & mask_];
+                if (cell->sequence.load(std::memory_order_acquire) != pos + n + 1)
+                    break;
+                n++;
+            }
+
+            if (n == 0) {
+                Cell *cell = &cell_list_[pos & mask_];
+                intptr_t diff = (intptr_t) cell->sequence.load(std::memory_order_acquire) - (intptr_t) (pos + 1);
+                if (diff < 0)
+                    return 0;
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                for (size_t i = 0; i < n; i++) {
+                    Cell *cell = &cell_list_[(pos + i) & mask_];
+                    value_list[i] = std::move(cell->data);
+                    cell->sequence.store(pos + i + mask_ + 1, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    /* 入队之后检查睡眠标记，和pluck中先设置标记再检查队列配对，两边至少有一边能看到对方.
+     * 清除标记的生产者唤醒所有睡眠的消费者，没有取到数据的消费者会重新设置标记，
+     * 所以在消费者重新睡眠之前，之后的push都不需要系统调用 */
+    void WakeUp() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_relaxed) == 0 || sleeping_.exchange(0) == 0)
+            return;
+
+        FutexWake(INT_MAX);
+    }
+
+    void FutexWait(const int futex_value) {
+        syscall(SYS_futex, &sleeping_, FUTEX_WAIT_PRIVATE, futex_value, nullptr, nullptr, 0);
+    }
+
+    void FutexWake(const int count) {
+        syscall(SYS_futex, &sleeping_, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+    }
+
+    static void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    //用填充字节把入队位置、出队位置和等待者相关的变量分到不同的cache line.
+    //没有使用alignas，C++11的new不保证超过16字节的对齐
+    char pad0_[THREAD_QUEUE_CACHE_LINE_SIZE];
+    std::atomic<size_t> enqueue_pos_;
+    char pad1_[THREAD_QUEUE_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> dequeue_pos_;
+    char pad2_[THREAD_QUEUE_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    //futex的值，为1时表示可能有消费者在futex上睡眠
+    std::atomic_int sleeping_{0};
+    std::atomic_bool break_out_;
+    char pad3_[THREAD_QUEUE_CACHE_LINE_SIZE - sizeof(std::atomic_int) - sizeof(std::atomic_bool)];
+    std::unique_ptr<Cell[]> cell_list_;
+    size_t capacity_;
+    size_t mask_;
 };
 
-}
\ No newline at end of file
+}